@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+
+// Scratch memory of one compilation. The passes and analyses take their
+// temporary containers, loop nests, maps of cell deltas, copies of the ops
+// being rewritten, from it, and nothing is freed on its own: everything
+// goes at once when the compilation is done, see BFArenaScope. What they
+// return, the program and its analyses, is on the heap as before.
+//
+// Each thread has an arena of its own, local(), so compilations on a
+// thread pool never contend for the allocator. An arena keeps its largest
+// size: memory a compilation needed past the buffer is taken from the heap,
+// and the buffer grows to cover it on reset(), so once warmed up to the
+// programs a thread compiles it doesn't touch the heap for scratch at all,
+// up to MAX_SIZE.
+class BFArena
+{
+public:
+    static constexpr std::size_t INITIAL_SIZE = 64 * 1024;
+    static constexpr std::size_t MAX_SIZE = 64 * 1024 * 1024; // the buffer grows no further
+
+private:
+    // the heap, counting what the arena had to take from it
+    class Overflow final : public std::pmr::memory_resource
+    {
+    public:
+        std::size_t taken = 0;
+
+    private:
+        void *do_allocate(std::size_t bytes, std::size_t alignment) override
+        {
+            void *memory = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            taken += bytes;
+            return memory;
+        }
+
+        void do_deallocate(void *memory, std::size_t bytes, std::size_t alignment) override
+        {
+            std::pmr::new_delete_resource()->deallocate(memory, bytes, alignment);
+        }
+
+        [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    std::size_t m_size;
+    std::unique_ptr<std::byte[]> m_buffer;
+    Overflow m_overflow;
+    std::optional<std::pmr::monotonic_buffer_resource> m_resource;
+    std::size_t m_depth = 0; // of the BFArenaScopes open on it
+
+    friend class BFArenaScope;
+
+public:
+    explicit BFArena(std::size_t size = INITIAL_SIZE)
+        : m_size{size ? size : 1}, m_buffer{std::make_unique_for_overwrite<std::byte[]>(m_size)}
+    {
+        m_resource.emplace(m_buffer.get(), m_size, &m_overflow);
+    }
+
+    BFArena(const BFArena &) = delete;
+    BFArena &operator=(const BFArena &) = delete;
+
+    [[nodiscard]] static BFArena &local()
+    {
+        thread_local BFArena arena;
+        return arena;
+    }
+
+    [[nodiscard]] std::pmr::memory_resource *resource() noexcept
+    {
+        return &*m_resource;
+    }
+
+    // bytes of the buffer, not counting what was taken from the heap since
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    // Frees everything at once. A buffer that was too small is replaced by
+    // one as large as the buffer and the heap memory together, where that
+    // can be had.
+    void reset() noexcept
+    {
+        m_resource->release();
+
+        const std::size_t size = std::min(m_size + m_overflow.taken, MAX_SIZE);
+        m_overflow.taken = 0;
+        if (size <= m_size)
+            return;
+
+        std::unique_ptr<std::byte[]> buffer{new (std::nothrow) std::byte[size]};
+        if (!buffer)
+            return;
+
+        m_resource.reset();
+        m_buffer = std::move(buffer);
+        m_size = size;
+        m_resource.emplace(m_buffer.get(), m_size, &m_overflow);
+    }
+};
+
+// Lends the thread's arena to a compilation and resets it at the end of
+// the outermost scope, so compilations that start others, a program and
+// the analyses made for it, share one arena and one reset.
+class BFArenaScope
+{
+private:
+    BFArena &m_arena;
+
+public:
+    BFArenaScope() : m_arena{BFArena::local()}
+    {
+        ++m_arena.m_depth;
+    }
+
+    BFArenaScope(const BFArenaScope &) = delete;
+    BFArenaScope &operator=(const BFArenaScope &) = delete;
+
+    ~BFArenaScope()
+    {
+        if (--m_arena.m_depth == 0)
+            m_arena.reset();
+    }
+
+    [[nodiscard]] std::pmr::memory_resource *resource() noexcept
+    {
+        return m_arena.resource();
+    }
+};
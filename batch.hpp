@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "execution.hpp"
+#include "program.hpp"
+#include "stats.hpp"
+
+struct BFBatchOptions
+{
+    std::size_t threads = 0; // 0 for one per hardware thread
+    std::size_t window = 0;  // tasks in flight, 0 for 4 per thread
+};
+
+// one task's output, why it stopped early if it did and what it did, see
+// BFExecution::stats()
+struct BFBatchResult
+{
+    std::string output;
+    std::optional<BFError> error;
+    BFStats stats;
+};
+
+// Runs one program against many inputs on a pool of threads. Every worker
+// has its own execution, reset between tasks, and all of them share the
+// compiled program; each task has the limits of the options to itself.
+// Tasks are dealt round robin onto one deque per worker; a worker takes
+// the oldest task of its own deque and steals the newest of another one
+// when its own runs dry.
+//
+// Results are handed over strictly in task order. At most `window` tasks
+// are in flight, started or finished but not yet handed over, which bounds
+// the memory held for inputs and outputs whatever the number of tasks.
+template <typename Cell = std::uint8_t>
+class BFBatch
+{
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<std::size_t> tasks;
+    };
+
+    std::size_t m_count;
+    std::size_t m_window;
+    std::unique_ptr<Queue[]> m_queues;
+    std::size_t m_workers;
+
+    std::mutex m_lock; // guards everything below, taken before a queue lock
+    std::condition_variable m_released_task;
+    std::atomic<std::ptrdiff_t> m_queued{0}; // may dip below 0 while a release is under way
+    std::size_t m_released = 0;
+    std::size_t m_collected = 0;
+    bool m_collecting = false;
+    std::vector<std::optional<BFBatchResult>> m_slots; // task i in slot i % window
+
+    BFBatch(std::size_t count, std::size_t workers, std::size_t window)
+        : m_count{count},
+          m_window{window},
+          m_queues{std::make_unique<Queue[]>(workers)},
+          m_workers{workers},
+          m_slots(window)
+    {
+    }
+
+public:
+    // Runs the program for tasks 0 to count - 1. load(i) returns the input
+    // of task i as std::expected<std::string, BFError> and is called on the
+    // workers, any number at once. collect(i, BFBatchResult) is called in
+    // the order of i, one call at a time. Fails only when a worker's tape
+    // can't be reserved. Profiling options are ignored.
+    template <typename Load, typename Collect>
+    [[nodiscard]] static std::expected<void, BFError> run(const BFCompiledProgram::Pointer &program,
+                                                          BFRunOptions options, const BFBatchOptions &batch,
+                                                          std::size_t count, Load &&load, Collect &&collect)
+    {
+        if (count == 0)
+            return {};
+
+        options.profile = nullptr;
+        options.profile_folded.clear();
+
+        const std::size_t threads = batch.threads ? batch.threads : std::max(1u, std::thread::hardware_concurrency());
+        const std::size_t workers = std::min(threads, count);
+        const std::size_t window = std::max(batch.window ? batch.window : 4 * workers, workers);
+
+        // the inputs are bound per task
+        std::istringstream no_input;
+        std::ostringstream no_output;
+
+        std::vector<typename BFExecution<Cell>::Pointer> executions;
+        for (std::size_t i = 0; i < workers; ++i)
+        {
+            auto execution = BFExecution<Cell>::create(program, options, no_input, no_output);
+            if (!execution)
+                return std::unexpected{std::move(execution.error())};
+            executions.push_back(std::move(*execution));
+        }
+
+        BFBatch state{count, workers, window};
+        {
+            std::lock_guard lock{state.m_lock};
+            while (state.m_released < std::min(count, window))
+                state.release();
+        }
+
+        {
+            std::vector<std::jthread> threads_running;
+            for (std::size_t i = 0; i < workers; ++i)
+                threads_running.emplace_back([&, i] { state.work(i, *executions[i], load, collect); });
+        }
+
+        return {};
+    }
+
+    // every input in memory, the results in the same order
+    [[nodiscard]] static std::expected<std::vector<BFBatchResult>, BFError> run(
+        const BFCompiledProgram::Pointer &program, const BFRunOptions &options, const BFBatchOptions &batch,
+        std::span<const std::string> inputs)
+    {
+        std::vector<BFBatchResult> results(inputs.size());
+        const auto ran = run(
+            program, options, batch, inputs.size(),
+            [&](std::size_t i) { return std::expected<std::string, BFError>{inputs[i]}; },
+            [&](std::size_t i, BFBatchResult result) { results[i] = std::move(result); });
+        if (!ran)
+            return std::unexpected{ran.error()};
+
+        return results;
+    }
+
+private:
+    // puts the next task on a deque, with m_lock held
+    void release()
+    {
+        const std::size_t task = m_released++;
+        {
+            Queue &queue = m_queues[task % m_workers];
+            std::lock_guard lock{queue.lock};
+            queue.tasks.push_back(task);
+        }
+
+        ++m_queued;
+        m_released_task.notify_one();
+    }
+
+    [[nodiscard]] std::optional<std::size_t> take(std::size_t worker)
+    {
+        for (std::size_t k = 0; k < m_workers; ++k)
+        {
+            Queue &queue = m_queues[(worker + k) % m_workers];
+            std::lock_guard lock{queue.lock};
+            if (queue.tasks.empty())
+                continue;
+
+            std::size_t task;
+            if (k == 0)
+            {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            else
+            {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+
+            --m_queued;
+            return task;
+        }
+
+        return std::nullopt;
+    }
+
+    template <typename Load, typename Collect>
+    void work(std::size_t worker, BFExecution<Cell> &execution, Load &load, Collect &collect)
+    {
+        for (;;)
+        {
+            const std::optional<std::size_t> task = take(worker);
+            if (!task)
+            {
+                std::unique_lock lock{m_lock};
+                m_released_task.wait(lock, [&] { return m_queued > 0 || m_released == m_count; });
+                if (m_queued > 0)
+                    continue;
+
+                // everything is released and nothing is left to take
+                m_released_task.notify_all();
+                return;
+            }
+
+            BFBatchResult result;
+            if (auto input = load(*task); !input)
+                result.error = std::move(input.error());
+            else
+            {
+                std::istringstream in{std::move(*input)};
+                std::ostringstream out;
+                execution.reset(in, out);
+                execution.clear_stats();
+                if (const auto ran = execution.run(); !ran)
+                    result.error = ran.error();
+                result.stats = execution.stats();
+                result.output = std::move(out).str();
+            }
+
+            finish(*task, std::move(result), collect);
+        }
+    }
+
+    // Stores a result, and hands over every result that is next in order
+    // unless another worker is already doing so. Each one handed over
+    // frees a slot and releases the task that goes in it.
+    template <typename Collect>
+    void finish(std::size_t task, BFBatchResult result, Collect &collect)
+    {
+        std::unique_lock lock{m_lock};
+        m_slots[task % m_window] = std::move(result);
+        if (m_collecting)
+            return;
+
+        m_collecting = true;
+        while (m_collected < m_count && m_slots[m_collected % m_window])
+        {
+            const std::size_t next = m_collected++;
+            BFBatchResult ready = std::move(*m_slots[next % m_window]);
+            m_slots[next % m_window].reset();
+
+            if (m_released < m_count)
+                release();
+            else if (m_collected == m_count)
+                m_released_task.notify_all();
+
+            lock.unlock();
+            collect(next, std::move(ready));
+            lock.lock();
+        }
+
+        m_collecting = false;
+    }
+};
@@ -0,0 +1,468 @@
+#include <chrono>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "io.hpp"
+#include "ir.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "tape.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BF_HAS_BENCH 1
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#define BF_HAS_BENCH 0
+#endif
+
+// Runs a corpus of programs through the bf-interpreter executable for
+// every engine and optimization level and reports the results as JSON.
+// Each run is its own process, so peak RSS is that of one run alone.
+
+#ifndef BF_INTERPRETER
+#define BF_INTERPRETER "bf-interpreter"
+#endif
+
+struct BFBenchProgram
+{
+    std::string name;
+    std::string source;
+    std::string input;
+    BFEofMode eof = BFEofMode::UNCHANGED;
+};
+
+// a program written out for the interpreter
+struct BFBenchCase
+{
+    std::string name;
+    std::string source;
+    std::string input; // empty for no input
+    BFEofMode eof = BFEofMode::UNCHANGED;
+    std::optional<std::uint64_t> instructions;
+};
+
+struct BFBenchRun
+{
+    double wall_seconds = 0;
+    long peak_rss_kib = 0;
+    int exit_status = 0;
+};
+
+// a small fixed generator, so the corpus is the same on every machine
+class BFBenchRandom
+{
+private:
+    std::uint64_t m_state;
+
+public:
+    explicit BFBenchRandom(std::uint64_t seed) noexcept
+        : m_state{seed}
+    {
+    }
+
+    [[nodiscard]] std::uint32_t next(std::uint32_t bound) noexcept
+    {
+        m_state = m_state * 6364136223846793005u + 1442695040888963407u;
+        return static_cast<std::uint32_t>((m_state >> 33) % bound);
+    }
+};
+
+// four nested counted loops around a short body, all steps of 2 so the
+// optimizer can't turn them into multiplications
+[[nodiscard]] static BFBenchProgram loops_program()
+{
+    const std::string counter(134, '+');
+    std::string source = counter + "[>" + counter + "[>" + counter + "[>" + counter;
+    source += "[>+>++>+++>----<<<<--]<--]<--]<--]";
+    return BFBenchProgram{.name = "loops", .source = source};
+}
+
+// a 20000 cell run of ones walked end to end, with [<] and [>] scans
+[[nodiscard]] static BFBenchProgram scan_program()
+{
+    std::string source = ">";
+    for (int i = 0; i < 20'000; ++i)
+        source += "+>";
+    source += ">" + std::string(40, '+') + "[>" + std::string(50, '+') + "[<<<[<]>[>]>>-]<-]";
+    return BFBenchProgram{.name = "scan", .source = source};
+}
+
+// 255^3 bytes of output from three nested loops
+[[nodiscard]] static BFBenchProgram output_program()
+{
+    return BFBenchProgram{.name = "output", .source = ">-[>-[>-[<<<.+>>>-]<-]<-]"};
+}
+
+// 16 MiB of input copied to the output
+[[nodiscard]] static BFBenchProgram echo_program()
+{
+    BFBenchRandom random{1};
+    std::string input(16 * 1024 * 1024, '\0');
+    for (char &c : input)
+        c = static_cast<char>(1 + random.next(255));
+
+    return BFBenchProgram{.name = "echo", .source = ",[.,]", .input = std::move(input), .eof = BFEofMode::ZERO};
+}
+
+// about 8 MiB of generated straight-line blocks and small counted loops,
+// dominated by parsing, optimizing and compiling rather than running
+[[nodiscard]] static BFBenchProgram huge_program()
+{
+    constexpr std::uint32_t CELLS = 1000;
+
+    BFBenchRandom random{2};
+    std::string source;
+    std::uint32_t ptr = 0;
+
+    while (source.size() < 8 * 1024 * 1024)
+    {
+        switch (random.next(4))
+        {
+        case 0:
+            source.append(1 + random.next(20), random.next(2) ? '+' : '-');
+            break;
+
+        case 1:
+        {
+            const std::uint32_t target = random.next(CELLS);
+            source.append(target > ptr ? target - ptr : ptr - target, target > ptr ? '>' : '<');
+            ptr = target;
+            break;
+        }
+
+        case 2:
+            // clear the counter, then run a body at the next cells that comes back
+            if (ptr + 4 < CELLS)
+            {
+                source += "[-]" + std::string(1 + random.next(10), '+') + "[>";
+                source.append(1 + random.next(5), '+');
+                source += ">";
+                source.append(1 + random.next(5), '-');
+                source += "<<-]";
+            }
+            break;
+
+        default:
+            if (random.next(8) == 0)
+                source += '.';
+            break;
+        }
+    }
+
+    return BFBenchProgram{.name = "huge", .source = std::move(source)};
+}
+
+// BF commands the unoptimized program executes, nullopt when it leaves a
+// default-sized tape
+[[nodiscard]] static std::optional<std::uint64_t> count_instructions(const BFBenchProgram &program)
+{
+    const auto parsed = BFParser::parse(program.source);
+    if (!parsed)
+        return std::nullopt;
+
+    const std::vector<BFOp> &ops = parsed->ops;
+    std::vector<std::uint8_t> tape(BFTape::DEFAULT_SIZE);
+    std::size_t ptr = 0, input = 0;
+    std::uint64_t count = 0;
+
+    for (std::size_t i = 0;; ++i)
+    {
+        const BFOp &op = ops[i];
+        switch (op.code)
+        {
+        case BFOpCode::ADD:
+            tape[ptr] = static_cast<std::uint8_t>(tape[ptr] + op.arg);
+            count += static_cast<std::uint64_t>(op.arg < 0 ? -static_cast<std::int64_t>(op.arg) : op.arg);
+            break;
+
+        case BFOpCode::MOVE:
+        {
+            const auto target = static_cast<std::int64_t>(ptr) + op.arg;
+            if (target < 0 || target >= static_cast<std::int64_t>(tape.size()))
+                return std::nullopt;
+            ptr = static_cast<std::size_t>(target);
+            count += static_cast<std::uint64_t>(op.arg < 0 ? -static_cast<std::int64_t>(op.arg) : op.arg);
+            break;
+        }
+
+        case BFOpCode::IN:
+            if (input < program.input.size())
+                tape[ptr] = static_cast<std::uint8_t>(program.input[input++]);
+            else if (program.eof == BFEofMode::ZERO)
+                tape[ptr] = 0;
+            else if (program.eof == BFEofMode::MINUS_ONE)
+                tape[ptr] = 0xFF;
+            ++count;
+            break;
+
+        case BFOpCode::LOOP_BEGIN:
+            if (tape[ptr] == 0)
+                i = op.jump;
+            ++count;
+            break;
+
+        case BFOpCode::LOOP_END:
+            if (tape[ptr])
+                i = op.jump;
+            ++count;
+            break;
+
+        case BFOpCode::END:
+            return count;
+
+        default:
+            ++count;
+            break;
+        }
+    }
+}
+
+[[nodiscard]] static std::string json_string(std::string_view text)
+{
+    std::string out = "\"";
+    for (const char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+
+        if (static_cast<unsigned char>(c) < 0x20)
+        {
+            constexpr char HEX[] = "0123456789abcdef";
+            out += "\\u00";
+            out += HEX[(c >> 4) & 0xF];
+            out += HEX[c & 0xF];
+        }
+        else
+            out += c;
+    }
+    return out + '"';
+}
+
+#if BF_HAS_BENCH
+// one run of the interpreter with stdin from `input`, output discarded
+[[nodiscard]] static BFBenchRun run_interpreter(const std::string &interpreter, const std::vector<std::string> &args,
+                                                const std::string &input)
+{
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(interpreter.c_str()));
+    for (const std::string &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        const int in = open(input.empty() ? "/dev/null" : input.c_str(), O_RDONLY);
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(in, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(interpreter.c_str(), argv.data());
+        _exit(127);
+    }
+
+    BFBenchRun run;
+    if (pid < 0)
+    {
+        run.exit_status = -1;
+        return run;
+    }
+
+    int status = 0;
+    struct rusage usage{};
+    wait4(pid, &status, 0, &usage);
+
+    run.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#if defined(__APPLE__)
+    run.peak_rss_kib = usage.ru_maxrss / 1024; // bytes there
+#else
+    run.peak_rss_kib = usage.ru_maxrss;
+#endif
+    run.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return run;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    const char *USAGE = R"==(Usage
+
+    bf-bench [options] [<path-to-source>...]
+
+Runs the built-in corpus (loops, scan, output, echo, huge) and any given
+programs, with empty input, through every engine and optimization level,
+and prints wall time, instructions per second and peak RSS as JSON.
+
+Options
+
+    --interpreter=<path>
+                 the bf-interpreter executable to measure
+    --engine=<name>
+                 only this engine, may be repeated
+    -O<level>    only this optimization level, may be repeated
+    --repeat=<n> runs per measurement, the fastest is reported (default 3)
+    --check-bounds
+                 run with bounds checks, to measure what they cost
+    --no-corpus  only run the given programs
+    )==";
+
+#if BF_HAS_BENCH
+    std::string interpreter = BF_INTERPRETER;
+    std::vector<std::string> engines;
+    std::vector<int> levels;
+    std::size_t repeat = 3;
+    bool corpus = true;
+    bool check_bounds = false;
+    std::vector<std::function<BFBenchProgram()>> generators;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg{argv[i]};
+        if (arg.starts_with("--interpreter="))
+            interpreter = arg.substr(14);
+        else if (arg == "--engine=switch" || arg == "--engine=threaded" || arg == "--engine=jit" ||
+                 arg == "--engine=tiered")
+            engines.emplace_back(arg.substr(9));
+        else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' &&
+                 arg[2] <= '0' + BFOptimizeOptions::MAX_LEVEL)
+            levels.push_back(arg[2] - '0');
+        else if (arg.starts_with("--repeat="))
+        {
+            const auto value = arg.substr(9);
+            const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), repeat);
+            if (error != std::errc{} || end != value.data() + value.size() || repeat == 0)
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+        }
+        else if (arg == "--no-corpus")
+            corpus = false;
+        else if (arg == "--check-bounds")
+            check_bounds = true;
+        else if (arg.starts_with("--"))
+        {
+            std::cerr << USAGE;
+            return 1;
+        }
+        else
+        {
+            if (!std::filesystem::is_regular_file(arg))
+            {
+                std::cerr << "Could not read " << arg << ".\n";
+                return 1;
+            }
+
+            generators.emplace_back([path = std::string{arg}]
+            {
+                std::ifstream file{path, std::ifstream::binary};
+                return BFBenchProgram{.name = path, .source = std::string{std::istreambuf_iterator<char>{file}, {}}};
+            });
+        }
+    }
+
+    if (engines.empty())
+        engines = {"switch", "threaded", "jit", "tiered"};
+
+    if (levels.empty())
+        for (int level = 0; level <= BFOptimizeOptions::MAX_LEVEL; ++level)
+            levels.push_back(level);
+
+    if (corpus)
+        generators.insert(generators.begin(),
+                          {loops_program, scan_program, output_program, echo_program, huge_program});
+
+    // The interpreter takes sources as files, so every program is written
+    // out and counted up front. Only then are runs forked: a child starts
+    // out with the parent's RSS as its peak, so the parent must not hold
+    // the corpus by then.
+    const std::filesystem::path directory =
+        std::filesystem::temp_directory_path() / ("bf-bench-" + std::to_string(getpid()));
+    std::filesystem::create_directories(directory);
+
+    std::vector<BFBenchCase> cases;
+    for (std::size_t p = 0; p < generators.size(); ++p)
+    {
+        const BFBenchProgram program = generators[p]();
+
+        BFBenchCase &bench_case = cases.emplace_back();
+        bench_case.name = program.name;
+        bench_case.eof = program.eof;
+        bench_case.instructions = count_instructions(program);
+
+        bench_case.source = (directory / (std::to_string(p) + ".b")).string();
+        std::ofstream{bench_case.source, std::ofstream::binary} << program.source;
+
+        if (!program.input.empty())
+        {
+            bench_case.input = (directory / (std::to_string(p) + ".in")).string();
+            std::ofstream{bench_case.input, std::ofstream::binary} << program.input;
+        }
+    }
+
+    std::cout << "{\n  \"interpreter\": " << json_string(interpreter) << ",\n  \"repeat\": " << repeat
+              << ",\n  \"check_bounds\": " << (check_bounds ? "true" : "false") << ",\n  \"results\": [";
+
+    bool first = true;
+    for (const BFBenchCase &bench_case : cases)
+    {
+        for (const std::string &engine : engines)
+        {
+            for (const int level : levels)
+            {
+                std::vector<std::string> args{"--engine=" + engine, "-O" + std::to_string(level)};
+                if (bench_case.eof == BFEofMode::ZERO)
+                    args.emplace_back("--eof=0");
+                if (check_bounds)
+                    args.emplace_back("--check-bounds");
+                args.push_back(bench_case.source);
+
+                BFBenchRun best;
+                for (std::size_t r = 0; r < repeat; ++r)
+                {
+                    const BFBenchRun run = run_interpreter(interpreter, args, bench_case.input);
+                    if (r == 0 || run.wall_seconds < best.wall_seconds)
+                        best = run;
+                }
+
+                std::cout << (first ? "\n" : ",\n") << "    {\"program\": " << json_string(bench_case.name)
+                          << ", \"engine\": " << json_string(engine) << ", \"level\": " << level
+                          << ", \"instructions\": ";
+                if (bench_case.instructions)
+                    std::cout << *bench_case.instructions << ", \"instructions_per_second\": "
+                              << static_cast<double>(*bench_case.instructions) / best.wall_seconds;
+                else
+                    std::cout << "null, \"instructions_per_second\": null";
+                std::cout << ", \"wall_seconds\": " << best.wall_seconds << ", \"peak_rss_kib\": " << best.peak_rss_kib
+                          << ", \"exit_status\": " << best.exit_status << '}' << std::flush;
+                first = false;
+            }
+        }
+    }
+
+    std::cout << "\n  ]\n}\n";
+
+    std::filesystem::remove_all(directory);
+    return 0;
+#else
+    static_cast<void>(argc);
+    static_cast<void>(argv);
+    std::cerr << USAGE << "\nbf-bench needs a POSIX system to run the interpreter.\n";
+    return 1;
+#endif
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#define BF_HAS_SIMD_BLOCK 1
+#include <emmintrin.h>
+#else
+#define BF_HAS_SIMD_BLOCK 0
+#endif
+
+// Runs ADD_VEC, cells[i] += deltas[i] for i < count. The window is split
+// into 16, 8 and 4 byte vector adds, largest first, and whatever is left
+// takes scalar adds. Nothing outside the window is loaded or stored, so a
+// window at either end of the tape stays off the guard regions.
+template <typename Cell>
+void add_block(Cell *cells, const Cell *deltas, std::size_t count) noexcept
+{
+    std::size_t i = 0;
+
+#if BF_HAS_SIMD_BLOCK
+    const auto add = [](__m128i a, __m128i b)
+    {
+        if constexpr (sizeof(Cell) == 1)
+            return _mm_add_epi8(a, b);
+        else if constexpr (sizeof(Cell) == 2)
+            return _mm_add_epi16(a, b);
+        else
+            return _mm_add_epi32(a, b);
+    };
+
+    for (; i + 16 / sizeof(Cell) <= count; i += 16 / sizeof(Cell))
+    {
+        const __m128i sum = add(_mm_loadu_si128(reinterpret_cast<const __m128i *>(cells + i)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i *>(deltas + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cells + i), sum);
+    }
+
+    if (i + 8 / sizeof(Cell) <= count)
+    {
+        const __m128i sum = add(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(cells + i)),
+                                _mm_loadl_epi64(reinterpret_cast<const __m128i *>(deltas + i)));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(cells + i), sum);
+        i += 8 / sizeof(Cell);
+    }
+
+    // a single 32-bit cell is no better off in a vector
+    if (sizeof(Cell) < 4 && i + 4 / sizeof(Cell) <= count)
+    {
+        std::int32_t cell_bits, delta_bits;
+        std::memcpy(&cell_bits, cells + i, 4);
+        std::memcpy(&delta_bits, deltas + i, 4);
+
+        const auto sum = _mm_cvtsi128_si32(add(_mm_cvtsi32_si128(cell_bits), _mm_cvtsi32_si128(delta_bits)));
+        std::memcpy(cells + i, &sum, 4);
+        i += 4 / sizeof(Cell);
+    }
+#endif
+
+    for (; i < count; ++i)
+        cells[i] = static_cast<Cell>(cells[i] + deltas[i]);
+}
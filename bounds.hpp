@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "ir.hpp"
+
+// cells that must be on the tape, ptr[low] to ptr[high], none when low > high
+struct BFRangeCheck
+{
+    std::int64_t low = 0;
+    std::int64_t high = -1;
+    bool every_iteration = false; // of a LOOP_BEGIN, see BFBounds
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return low > high;
+    }
+};
+
+// Where --check-bounds checks the tape pointer, with ranges relative to
+// the pointer at the check. start is checked when a run starts. The check
+// of a LOOP_BEGIN runs on entering the loop body, and on every back-edge as
+// well when every_iteration is set. The check of a LOOP_END runs on leaving
+// the loop, whether the loop ran or not, the check of a SCAN, IN or OUT
+// after the op, and the check of a MUL_ADD before it, only where its
+// source isn't 0. Other ops have no check.
+struct BFBounds
+{
+    BFRangeCheck start;
+    std::vector<BFRangeCheck> checks; // one per op
+};
+
+// Abstract interpretation of the pointer over the IR. Between two checks
+// the pointer is known as an offset from where it was at the first one,
+// and every cell touched on the way widens the range of that check; a
+// MOVE only shifts the offset, so moves cost nothing. A balanced loop, one
+// whose body has a net move of 0 and contains no SCAN or unbalanced loop,
+// starts every iteration on the same cell, so one check of its body on
+// entry covers all iterations. The body of any other loop is checked per
+// iteration. Code that may not run or never finish, a loop, is never
+// covered from before it, and neither is code after a , or ., so a check
+// only fails where an unchecked run would have left the tape, once the
+// same output was written and input read. Nor is the target of a MUL_ADD,
+// which is left alone where the loop it came from never ran; it is
+// checked at the op unless the range of its check lies around it, whose
+// ends are cells every run touches. The nests on the way come from
+// scratch.
+[[nodiscard]] inline BFBounds analyze_bounds(BFProgramView program,
+                                             std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+{
+    const std::size_t size = program.ops.size();
+
+    // which loops are balanced, from the innermost out
+    struct Nest
+    {
+        std::int64_t moved = 0;
+        bool known = true;
+    };
+
+    std::pmr::vector<bool> balanced(size, scratch);
+    std::pmr::vector<Nest> nests(1, scratch);
+    for (const BFOp &op : program.ops)
+    {
+        if (op.code == BFOpCode::MOVE)
+            nests.back().moved += op.arg;
+        else if (op.code == BFOpCode::SCAN)
+            nests.back().known = false;
+        else if (op.code == BFOpCode::LOOP_BEGIN)
+            nests.emplace_back();
+        else if (op.code == BFOpCode::LOOP_END)
+        {
+            const Nest body = nests.back();
+            nests.pop_back();
+            balanced[op.jump] = body.known && body.moved == 0;
+            if (!balanced[op.jump])
+                nests.back().known = false;
+        }
+    }
+
+    // the check covering the code at hand, and the pointer relative to it
+    struct Region
+    {
+        BFRangeCheck *check;
+        std::int64_t at;
+    };
+
+    BFBounds bounds;
+    bounds.checks.resize(size);
+
+    Region region{&bounds.start, 0};
+
+    // the MUL_ADDs, each with the check before it and where its target lies
+    struct Target
+    {
+        std::size_t op;
+        Region region;
+    };
+    std::pmr::vector<Target> targets(scratch);
+
+    const auto touch = [&](std::int64_t low, std::int64_t high)
+    {
+        BFRangeCheck &check = *region.check;
+        if (check.empty())
+        {
+            check.low = region.at + low;
+            check.high = region.at + high;
+        }
+        else
+        {
+            check.low = std::min(check.low, region.at + low);
+            check.high = std::max(check.high, region.at + high);
+        }
+    };
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const BFOp &op = program.ops[i];
+
+        switch (op.code)
+        {
+        case BFOpCode::ADD:
+        case BFOpCode::SET:
+            touch(op.offset, op.offset);
+            break;
+
+        // what follows I/O is checked after it, the I/O happens first
+        case BFOpCode::OUT:
+        case BFOpCode::IN:
+            touch(op.offset, op.offset);
+            region = Region{&bounds.checks[i], 0};
+            break;
+
+        case BFOpCode::MUL_ADD:
+            touch(op.src, op.src);
+            targets.push_back(Target{i, Region{region.check, region.at + op.offset}});
+            break;
+
+        case BFOpCode::ADD_VEC:
+            if (op.arg > 0)
+                touch(op.offset, std::int64_t{op.offset} + op.arg - 1);
+            break;
+
+        case BFOpCode::MOVE:
+            region.at += op.arg;
+            break;
+
+        // the scan stops on a cell it read, which the check after it covers
+        case BFOpCode::SCAN:
+            touch(0, 0);
+            region = Region{&bounds.checks[i], 0};
+            touch(0, 0);
+            break;
+
+        case BFOpCode::LOOP_BEGIN:
+            touch(0, 0);
+            bounds.checks[i].every_iteration = !balanced[i];
+            region = Region{&bounds.checks[i], 0};
+            break;
+
+        // the code after a loop is checked once the loop is done, whether
+        // it ends where it started or not
+        case BFOpCode::LOOP_END:
+            touch(0, 0);
+            region = Region{&bounds.checks[i], 0};
+            break;
+
+        case BFOpCode::END:
+            break;
+        }
+    }
+
+    for (const auto &[i, target] : targets)
+    {
+        const BFRangeCheck &around = *target.check;
+        if (around.empty() || target.at < around.low || target.at > around.high)
+            bounds.checks[i] = BFRangeCheck{.low = program.ops[i].offset, .high = program.ops[i].offset};
+    }
+
+    return bounds;
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+#include "loader.hpp"
+#include "optimizer.hpp"
+
+#ifndef BF_VERSION
+#define BF_VERSION "unknown"
+#endif
+
+static_assert(std::is_trivially_copyable_v<BFOp> && std::is_standard_layout_v<BFOp>);
+static_assert(sizeof(BFOp) == offsetof(BFOp, loc) + sizeof(BFSourceLoc), "BFOp has tail padding");
+
+// The header of a bytecode file. The file is this header, then the ops
+// at ops_offset, the ADD_VEC deltas at deltas_offset and the prefix cells
+// and output at prefix_offset, all as they are laid out in memory, so a
+// mapping of the file is run as it is. Loop ops carry the index of their
+// bracket, which makes the ops their own jump table.
+struct BFBytecodeHeader
+{
+    static constexpr char MAGIC[8] = {'B', 'F', 'C', 'O', 'D', 'E', '\r', '\n'};
+    static constexpr std::uint32_t FORMAT_VERSION = 2;
+    static constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304; // reads back swapped on the other endianness
+
+    char magic[8];
+    std::uint32_t format;
+    std::uint32_t op_size; // sizeof(BFOp) of the writer
+    std::uint32_t byte_order;
+    std::uint32_t passes;      // optimizer passes applied, bit n - 1 for the pass of -On
+    std::uint64_t source_hash; // BFHasher digest of the source, metadata only
+    std::uint64_t ops_offset;
+    std::uint64_t op_count;
+    std::uint64_t deltas_offset;
+    std::uint64_t delta_count;
+    char interpreter[16]; // BF_VERSION of the writer, metadata only
+    std::uint64_t prefixed; // 1 when the program has a prefix, see BFPrefix
+    std::uint64_t prefix_offset;
+    std::uint64_t prefix_cells;
+    std::uint64_t prefix_output; // bytes, right after the cells
+    std::int64_t prefix_pointer;
+    std::int64_t prefix_reach;
+    std::int64_t prefix_first;
+};
+
+enum class BFBytecodeError
+{
+    UNREADABLE,
+    NOT_BYTECODE,
+    VERSION, // bytecode of another format version or platform
+    MALFORMED
+};
+
+[[nodiscard]] constexpr const char *to_string(BFBytecodeError error) noexcept
+{
+    switch (error)
+    {
+    case BFBytecodeError::UNREADABLE:
+        return "could not read bytecode file";
+
+    case BFBytecodeError::NOT_BYTECODE:
+        return "not a bytecode file";
+
+    case BFBytecodeError::VERSION:
+        return "bytecode of another version or platform, compile it again";
+
+    case BFBytecodeError::MALFORMED:
+        return "damaged bytecode file";
+    }
+
+    return "?";
+}
+
+// A bytecode file written by --compile, mapped read-only. Opening one
+// checks the header and the ops (see is_well_formed()) and allocates
+// nothing; files that can't be mapped are read into a buffer instead.
+class BFBytecode
+{
+public:
+    static constexpr std::size_t OPS_ALIGNMENT = 64;
+
+private:
+    const void *m_memory = nullptr; // the mapping, null when read into m_buffer
+    std::size_t m_size = 0;
+    std::vector<std::uint64_t> m_buffer;
+
+    BFBytecodeHeader m_header{};
+    BFProgramView m_program;
+
+    BFBytecode() = default;
+
+public:
+    BFBytecode(BFBytecode &&other) noexcept
+        : m_memory{std::exchange(other.m_memory, nullptr)},
+          m_size{std::exchange(other.m_size, 0)},
+          m_buffer{std::move(other.m_buffer)},
+          m_header{other.m_header},
+          m_program{std::exchange(other.m_program, {})}
+    {
+    }
+
+    BFBytecode &operator=(BFBytecode &&other) noexcept
+    {
+        std::swap(m_memory, other.m_memory);
+        std::swap(m_size, other.m_size);
+        std::swap(m_buffer, other.m_buffer);
+        std::swap(m_header, other.m_header);
+        std::swap(m_program, other.m_program);
+        return *this;
+    }
+
+    BFBytecode(const BFBytecode &) = delete;
+    BFBytecode &operator=(const BFBytecode &) = delete;
+
+    ~BFBytecode()
+    {
+#if BF_HAS_MMAP
+        if (m_memory)
+            munmap(const_cast<void *>(m_memory), m_size);
+#endif
+    }
+
+    [[nodiscard]] static std::expected<BFBytecode, BFBytecodeError> open(const std::string &path)
+    {
+        BFBytecode bytecode;
+#if BF_HAS_MMAP
+        if (!bytecode.map(path))
+#endif
+            if (!bytecode.read(path))
+                return std::unexpected{BFBytecodeError::UNREADABLE};
+
+        const auto *bytes = static_cast<const char *>(
+            bytecode.m_memory ? bytecode.m_memory : static_cast<const void *>(bytecode.m_buffer.data()));
+        if (const auto error = bytecode.check(bytes))
+            return std::unexpected{*error};
+
+        return bytecode;
+    }
+
+    // false when the file could not be written
+    [[nodiscard]] static bool write(const std::string &path, BFProgramView program, const BFOptimizeOptions &options,
+                                    std::uint64_t source_hash)
+    {
+        BFBytecodeHeader header{};
+        std::memcpy(header.magic, BFBytecodeHeader::MAGIC, sizeof(header.magic));
+        header.format = BFBytecodeHeader::FORMAT_VERSION;
+        header.op_size = sizeof(BFOp);
+        header.byte_order = BFBytecodeHeader::BYTE_ORDER_MARK;
+        header.passes = passes(options);
+        header.source_hash = source_hash;
+        header.ops_offset = align(sizeof(header));
+        header.op_count = program.ops.size();
+        header.deltas_offset = header.ops_offset + program.ops.size() * sizeof(BFOp);
+        header.delta_count = program.deltas.size();
+        std::strncpy(header.interpreter, BF_VERSION, sizeof(header.interpreter) - 1);
+
+        header.prefix_offset = header.deltas_offset + program.deltas.size() * sizeof(std::int32_t);
+        if (const auto &prefix = program.prefix)
+        {
+            header.prefixed = 1;
+            header.prefix_cells = prefix->cells.size();
+            header.prefix_output = prefix->output.size();
+            header.prefix_pointer = prefix->pointer;
+            header.prefix_reach = prefix->reach;
+            header.prefix_first = prefix->first;
+        }
+
+        std::vector<char> bytes(header.prefix_offset + header.prefix_cells * sizeof(std::int32_t) +
+                                header.prefix_output);
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        std::memcpy(bytes.data() + header.ops_offset, program.ops.data(), program.ops.size() * sizeof(BFOp));
+        std::memcpy(bytes.data() + header.deltas_offset, program.deltas.data(),
+                    program.deltas.size() * sizeof(std::int32_t));
+        if (const auto &prefix = program.prefix)
+        {
+            std::memcpy(bytes.data() + header.prefix_offset, prefix->cells.data(),
+                        prefix->cells.size() * sizeof(std::int32_t));
+            std::memcpy(bytes.data() + header.prefix_offset + prefix->cells.size() * sizeof(std::int32_t),
+                        prefix->output.data(), prefix->output.size());
+        }
+
+        // clear the padding after each opcode, the same program always makes the same file
+        for (std::size_t i = 0; i < program.ops.size(); ++i)
+            std::memset(bytes.data() + header.ops_offset + i * sizeof(BFOp) + sizeof(BFOpCode), 0,
+                        offsetof(BFOp, arg) - sizeof(BFOpCode));
+
+        std::ofstream file{path, std::ofstream::binary | std::ofstream::trunc};
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        file.close();
+        return !file.fail();
+    }
+
+    [[nodiscard]] const BFBytecodeHeader &header() const noexcept
+    {
+        return m_header;
+    }
+
+    [[nodiscard]] BFProgramView program() const noexcept
+    {
+        return m_program;
+    }
+
+private:
+    [[nodiscard]] static constexpr std::uint64_t align(std::uint64_t offset) noexcept
+    {
+        return (offset + OPS_ALIGNMENT - 1) / OPS_ALIGNMENT * OPS_ALIGNMENT;
+    }
+
+    [[nodiscard]] static std::uint32_t passes(const BFOptimizeOptions &options) noexcept
+    {
+        const bool enabled[] = {options.clear_loops, options.scan_loops, options.multiply_loops,
+                                options.offset_cells, options.vector_adds};
+
+        std::uint32_t bits = 0;
+        for (std::size_t i = 0; i < std::size(enabled); ++i)
+            bits |= static_cast<std::uint32_t>(enabled[i]) << i;
+        return bits;
+    }
+
+#if BF_HAS_MMAP
+    [[nodiscard]] bool map(const std::string &path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info{};
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        const auto size = static_cast<std::size_t>(info.st_size);
+        void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+            return false;
+
+        m_memory = memory;
+        m_size = size;
+        return true;
+    }
+#endif
+
+    [[nodiscard]] bool read(const std::string &path)
+    {
+        std::ifstream file{path, std::ifstream::binary};
+        if (!file)
+            return false;
+
+        std::vector<char> bytes{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+        if (file.bad())
+            return false;
+
+        // 8-byte words keep the ops aligned
+        m_size = bytes.size();
+        m_buffer.resize((bytes.size() + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+        std::memcpy(m_buffer.data(), bytes.data(), bytes.size());
+        return true;
+    }
+
+    [[nodiscard]] std::optional<BFBytecodeError> check(const char *bytes)
+    {
+        if (m_size < sizeof(m_header))
+            return BFBytecodeError::NOT_BYTECODE;
+
+        std::memcpy(&m_header, bytes, sizeof(m_header));
+        if (std::memcmp(m_header.magic, BFBytecodeHeader::MAGIC, sizeof(m_header.magic)) != 0)
+            return BFBytecodeError::NOT_BYTECODE;
+
+        if (m_header.format != BFBytecodeHeader::FORMAT_VERSION || m_header.op_size != sizeof(BFOp) ||
+            m_header.byte_order != BFBytecodeHeader::BYTE_ORDER_MARK)
+            return BFBytecodeError::VERSION;
+
+        // every section inside the file and aligned, without overflowing
+        const std::uint64_t size = m_size;
+        if (m_header.ops_offset % alignof(BFOp) != 0 || m_header.deltas_offset % alignof(std::int32_t) != 0 ||
+            m_header.ops_offset > size || m_header.op_count > (size - m_header.ops_offset) / sizeof(BFOp) ||
+            m_header.deltas_offset > size ||
+            m_header.delta_count > (size - m_header.deltas_offset) / sizeof(std::int32_t))
+            return BFBytecodeError::MALFORMED;
+
+        m_program = BFProgramView{
+            {reinterpret_cast<const BFOp *>(bytes + m_header.ops_offset), m_header.op_count},
+            {reinterpret_cast<const std::int32_t *>(bytes + m_header.deltas_offset), m_header.delta_count}};
+
+        if (m_header.prefixed)
+        {
+            if (m_header.prefix_offset % alignof(std::int32_t) != 0 || m_header.prefix_offset > size ||
+                m_header.prefix_cells > (size - m_header.prefix_offset) / sizeof(std::int32_t) ||
+                m_header.prefix_output > size - m_header.prefix_offset - m_header.prefix_cells * sizeof(std::int32_t))
+                return BFBytecodeError::MALFORMED;
+
+            const char *cells = bytes + m_header.prefix_offset;
+            m_program.prefix = BFPrefixView{
+                m_header.prefix_pointer, m_header.prefix_reach, m_header.prefix_first,
+                {reinterpret_cast<const std::int32_t *>(cells), m_header.prefix_cells},
+                {cells + m_header.prefix_cells * sizeof(std::int32_t), m_header.prefix_output}};
+        }
+
+        if (!is_well_formed(m_program))
+            return BFBytecodeError::MALFORMED;
+
+        return std::nullopt;
+    }
+};
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "ir.hpp"
+#include "jit.hpp"
+#include "optimizer.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef BF_VERSION
+#define BF_VERSION "unknown"
+#endif
+
+// A 64-bit hash of a byte stream fed in arbitrary pieces, fast enough to
+// run over the whole source on every start. Not cryptographic.
+class BFHasher
+{
+private:
+    static constexpr std::uint64_t MULTIPLIER = 0x9FB21C651E98DF25u;
+
+    std::uint64_t m_state = 0x9E3779B97F4A7C15u;
+    std::uint64_t m_size = 0;
+    unsigned char m_tail[8]{};
+    std::size_t m_tail_size = 0;
+
+public:
+    void update(std::string_view bytes) noexcept
+    {
+        m_size += bytes.size();
+
+        // complete a word left over from the last piece first
+        while (m_tail_size && m_tail_size < sizeof(m_tail) && !bytes.empty())
+        {
+            m_tail[m_tail_size++] = static_cast<unsigned char>(bytes.front());
+            bytes.remove_prefix(1);
+        }
+
+        if (m_tail_size == sizeof(m_tail))
+        {
+            mix(m_tail);
+            m_tail_size = 0;
+        }
+
+        for (; bytes.size() >= sizeof(m_tail); bytes.remove_prefix(sizeof(m_tail)))
+            mix(bytes.data());
+
+        std::memcpy(m_tail + m_tail_size, bytes.data(), bytes.size());
+        m_tail_size += bytes.size();
+    }
+
+    [[nodiscard]] std::uint64_t digest() const noexcept
+    {
+        unsigned char tail[8]{};
+        std::memcpy(tail, m_tail, m_tail_size);
+
+        BFHasher last = *this;
+        last.mix(tail);
+
+        // the splitmix64 finalizer, over the length as well
+        std::uint64_t h = last.m_state ^ m_size;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9u;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBu;
+        return h ^ (h >> 31);
+    }
+
+private:
+    void mix(const void *bytes) noexcept
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+
+        // the shift carries high bits back down, a multiply only moves them up
+        m_state = (m_state ^ word) * MULTIPLIER;
+        m_state ^= m_state >> 29;
+    }
+};
+
+// An on-disk cache of optimized programs, and of their machine code, in
+// one directory. Entries are keyed by a hash over the source, the
+// optimizer options and the interpreter build, so a change to any of them
+// simply misses and stale entries are never read. Loading is best effort:
+// a missing, truncated, damaged or foreign entry is a miss, and a failed
+// store is ignored.
+//
+// Entries hold code that is mapped executable, so the cache only uses a
+// directory private to the user: one it creates with mode 0700, or one
+// the user owns that no one else may write to. Any other is left alone.
+class BFProgramCache
+{
+public:
+    static constexpr std::uint32_t FORMAT_VERSION = 4;
+
+private:
+    static constexpr char MAGIC[8] = {'B', 'F', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+    // an entry is this header, then `size` bytes of payload: the ops, the
+    // deltas, the prefix cells and the prefix output
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t format;
+        std::uint32_t op_size; // sizeof(BFOp), the payload is raw ops
+        std::uint64_t key;
+        std::uint64_t checksum; // BFHasher digest of the payload
+        std::uint64_t ops;
+        std::uint64_t deltas;
+        std::uint64_t size;
+        std::uint64_t prefixed; // 1 when the program has a prefix, see BFPrefix
+        std::int64_t prefix_pointer;
+        std::int64_t prefix_reach;
+        std::int64_t prefix_first;
+        std::uint64_t prefix_cells;
+        std::uint64_t prefix_output;
+    };
+
+    std::filesystem::path m_directory;
+
+    static inline std::atomic<std::uint64_t> s_temporaries{0};
+
+public:
+    explicit BFProgramCache(std::filesystem::path directory)
+        : m_directory{std::move(directory)}
+    {
+    }
+
+    // $XDG_CACHE_HOME/bf-interpreter, or ~/.cache/bf-interpreter, empty
+    // when neither is set: never a directory shared with other users
+    [[nodiscard]] static std::filesystem::path default_directory()
+    {
+        if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+            return std::filesystem::path{xdg} / "bf-interpreter";
+        if (const char *home = std::getenv("HOME"); home && *home)
+            return std::filesystem::path{home} / ".cache" / "bf-interpreter";
+
+        return {};
+    }
+
+    // the key of a source with the given hash, optimized with `options`
+    [[nodiscard]] static std::uint64_t key(std::uint64_t source_hash, const BFOptimizeOptions &options) noexcept
+    {
+        const unsigned char flags[] = {options.clear_loops, options.scan_loops, options.multiply_loops,
+                                       options.offset_cells, options.vector_adds};
+
+        BFHasher hasher;
+        hasher.update({reinterpret_cast<const char *>(&source_hash), sizeof(source_hash)});
+        hasher.update({reinterpret_cast<const char *>(flags), sizeof(flags)});
+        hasher.update({reinterpret_cast<const char *>(&options.prefix_steps), sizeof(options.prefix_steps)});
+        hasher.update({reinterpret_cast<const char *>(&FORMAT_VERSION), sizeof(FORMAT_VERSION)});
+        // the build stamp invalidates entries whenever the interpreter is rebuilt
+        hasher.update(BF_VERSION " " __DATE__ " " __TIME__);
+        return hasher.digest();
+    }
+
+    [[nodiscard]] std::optional<BFProgram> load(std::uint64_t key) const
+    {
+        if (!is_private(false))
+            return std::nullopt;
+
+        const auto entry = read(program_path(key), key);
+        if (!entry)
+            return std::nullopt;
+
+        const auto &[header, payload] = *entry;
+        if (header.ops > header.size / sizeof(BFOp) || header.deltas > header.size / sizeof(std::int32_t) ||
+            header.prefix_cells > header.size / sizeof(std::int32_t) || header.prefix_output > header.size ||
+            header.size != header.ops * sizeof(BFOp) + (header.deltas + header.prefix_cells) * sizeof(std::int32_t) +
+                               header.prefix_output)
+            return std::nullopt;
+
+        BFProgram program;
+        program.ops.resize(header.ops);
+        program.deltas.resize(header.deltas);
+        const char *bytes = payload.data();
+        std::memcpy(program.ops.data(), bytes, header.ops * sizeof(BFOp));
+        bytes += header.ops * sizeof(BFOp);
+        std::memcpy(program.deltas.data(), bytes, header.deltas * sizeof(std::int32_t));
+        bytes += header.deltas * sizeof(std::int32_t);
+
+        if (header.prefixed)
+        {
+            BFPrefix &prefix = program.prefix.emplace();
+            prefix.pointer = header.prefix_pointer;
+            prefix.reach = header.prefix_reach;
+            prefix.first = header.prefix_first;
+            prefix.cells.resize(header.prefix_cells);
+            std::memcpy(prefix.cells.data(), bytes, header.prefix_cells * sizeof(std::int32_t));
+            bytes += header.prefix_cells * sizeof(std::int32_t);
+            prefix.output.assign(bytes, header.prefix_output);
+        }
+
+        if (!is_well_formed(program))
+            return std::nullopt;
+
+        return program;
+    }
+
+    void store(std::uint64_t key, BFProgramView program) const
+    {
+        Header header{};
+        header.ops = program.ops.size();
+        header.deltas = program.deltas.size();
+
+        const auto append = [](std::vector<char> &out, const auto &items)
+        {
+            const auto *bytes = reinterpret_cast<const char *>(items.data());
+            out.insert(out.end(), bytes, bytes + items.size() * sizeof(items[0]));
+        };
+
+        std::vector<char> payload;
+        append(payload, program.ops);
+        append(payload, program.deltas);
+
+        if (const auto &prefix = program.prefix)
+        {
+            header.prefixed = 1;
+            header.prefix_pointer = prefix->pointer;
+            header.prefix_reach = prefix->reach;
+            header.prefix_first = prefix->first;
+            header.prefix_cells = prefix->cells.size();
+            header.prefix_output = prefix->output.size();
+            append(payload, prefix->cells);
+            append(payload, prefix->output);
+        }
+
+        write(program_path(key), key, header, payload);
+    }
+
+    // machine code of the program under `key`, for cells of `cell_bits`,
+    // in one of the modes of BFJitMode, preemptible or not
+    [[nodiscard]] std::optional<std::vector<std::uint8_t>> load_code(std::uint64_t key, int cell_bits,
+                                                                     BFJitMode mode, bool preemptible) const
+    {
+        if (!is_private(false))
+            return std::nullopt;
+
+        const auto entry = read(code_path(key, cell_bits, mode, preemptible), key);
+        if (!entry || entry->second.empty())
+            return std::nullopt;
+
+        return std::vector<std::uint8_t>(entry->second.begin(), entry->second.end());
+    }
+
+    void store_code(std::uint64_t key, int cell_bits, BFJitMode mode, bool preemptible,
+                    std::span<const std::uint8_t> code) const
+    {
+        write(code_path(key, cell_bits, mode, preemptible), key, Header{},
+              {reinterpret_cast<const char *>(code.data()), code.size()});
+    }
+
+private:
+    [[nodiscard]] std::filesystem::path program_path(std::uint64_t key) const
+    {
+        return m_directory / (hex(key) + ".ir");
+    }
+
+    [[nodiscard]] std::filesystem::path code_path(std::uint64_t key, int cell_bits, BFJitMode mode,
+                                                  bool preemptible) const
+    {
+        const char *const suffix = mode == BFJitMode::CHECKED         ? "c"
+                                   : mode == BFJitMode::STATS         ? "s"
+                                   : mode == BFJitMode::CHECKED_STATS ? "cs"
+                                                                      : "";
+        return m_directory / (hex(key) + ".jit" + std::to_string(cell_bits) + suffix + (preemptible ? "p" : ""));
+    }
+
+    // Whether the directory belongs to the user and no one else may write
+    // to it, created with mode 0700 first when `create` is set.
+    [[nodiscard]] bool is_private(bool create) const
+    {
+        if (m_directory.empty())
+            return false;
+
+        std::error_code error;
+#if defined(__unix__) || defined(__APPLE__)
+        if (create)
+        {
+            if (m_directory.has_parent_path())
+                std::filesystem::create_directories(m_directory.parent_path(), error);
+            ::mkdir(m_directory.c_str(), 0700);
+        }
+
+        struct stat status;
+        return ::stat(m_directory.c_str(), &status) == 0 && S_ISDIR(status.st_mode) &&
+               status.st_uid == ::geteuid() && (status.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+#else
+        if (create && std::filesystem::create_directories(m_directory, error))
+            std::filesystem::permissions(m_directory, std::filesystem::perms::owner_all,
+                                         std::filesystem::perm_options::replace, error);
+        return std::filesystem::is_directory(m_directory, error);
+#endif
+    }
+
+    [[nodiscard]] static std::uint64_t checksum(std::span<const char> payload) noexcept
+    {
+        BFHasher hasher;
+        hasher.update({payload.data(), payload.size()});
+        return hasher.digest();
+    }
+
+    [[nodiscard]] static std::string hex(std::uint64_t value)
+    {
+        constexpr char DIGITS[] = "0123456789abcdef";
+        std::string text(16, '0');
+        for (std::size_t i = 16; i-- > 0; value >>= 4)
+            text[i] = DIGITS[value & 0xF];
+        return text;
+    }
+
+    [[nodiscard]] static std::optional<std::pair<Header, std::vector<char>>> read(const std::filesystem::path &path,
+                                                                                std::uint64_t key)
+    {
+        std::ifstream file{path, std::ifstream::binary};
+        Header header{};
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+            return std::nullopt;
+
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.format != FORMAT_VERSION ||
+            header.op_size != sizeof(BFOp) || header.key != key)
+            return std::nullopt;
+
+        std::error_code error;
+        const std::uintmax_t file_size = std::filesystem::file_size(path, error);
+        if (error || file_size != sizeof(header) + header.size)
+            return std::nullopt;
+
+        std::vector<char> payload(header.size);
+        if (!file.read(payload.data(), static_cast<std::streamsize>(payload.size())) ||
+            checksum(payload) != header.checksum)
+            return std::nullopt;
+
+        return std::pair{header, std::move(payload)};
+    }
+
+    // Written to a temporary first and renamed, so readers never see half
+    // an entry. The header comes with the sections of the payload filled in.
+    void write(const std::filesystem::path &path, std::uint64_t key, Header header,
+               std::span<const char> payload) const
+    {
+        if (!is_private(true))
+            return;
+
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.format = FORMAT_VERSION;
+        header.op_size = sizeof(BFOp);
+        header.key = key;
+        header.checksum = checksum(payload);
+        header.size = payload.size();
+
+        // unique among the writers of this process and of every other one
+        std::filesystem::path temporary = path;
+        temporary += ".tmp" + std::to_string(s_temporaries++);
+#if defined(__unix__) || defined(__APPLE__)
+        temporary += "." + std::to_string(::getpid());
+#endif
+
+        std::error_code error;
+
+        {
+            std::ofstream file{temporary, std::ofstream::binary};
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+            if (!file)
+            {
+                file.close();
+                std::filesystem::remove(temporary, error);
+                return;
+            }
+        }
+
+        std::filesystem::rename(temporary, path, error);
+        if (error)
+            std::filesystem::remove(temporary, error);
+    }
+};
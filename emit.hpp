@@ -0,0 +1,504 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "bounds.hpp"
+#include "io.hpp"
+#include "ir.hpp"
+
+// Ahead-of-time translation of the optimized IR into standalone sources
+// for tapes of Cell. Generated programs read raw bytes with getchar() and
+// write the low 8 bits of a cell with putchar(), like the engines. Given
+// the result of analyze_bounds(), they also check the tape pointer where
+// the engines would and exit with an error when it leaves the tape. A
+// program with a prefix starts from it, its cells in the initial tape and
+// its output written first.
+
+// cell operands as unsigned constants of the cell width, the same
+// wraparound as the engines
+template <typename Cell>
+[[nodiscard]] std::uint32_t emit_cell_value(std::int32_t arg) noexcept
+{
+    return static_cast<Cell>(arg);
+}
+
+template <typename Cell>
+[[nodiscard]] constexpr const char *emit_c_cell_type() noexcept
+{
+    if constexpr (sizeof(Cell) == 1)
+        return "unsigned char";
+    else if constexpr (sizeof(Cell) == 2)
+        return "uint16_t";
+    else
+        return "uint32_t";
+}
+
+// the messages of a failed check in generated programs
+inline constexpr const char *BF_EMIT_BELOW = "Tape pointer moved below the first cell.\\n";
+inline constexpr const char *BF_EMIT_ABOVE = "Tape pointer moved past the last cell.\\n";
+
+// whether the prefix, if any, fits a tape of tape_size cells; generated
+// programs fail after the prefix output where it doesn't, like the engines
+[[nodiscard]] inline bool emit_prefix_fits(BFProgramView program, std::size_t tape_size) noexcept
+{
+    return !program.prefix || program.prefix->reach <= static_cast<std::int64_t>(tape_size);
+}
+
+// "+8" or "-8", for displacements after a symbol or register
+struct BFAsmDisp
+{
+    std::int64_t value;
+};
+
+inline std::ostream &operator<<(std::ostream &out, BFAsmDisp disp)
+{
+    if (disp.value >= 0)
+        out << '+';
+    return out << disp.value;
+}
+
+// items, `per_line` to a line, as "<start>a, b, c\n" lines
+template <typename Item, typename Print>
+void emit_lines(std::ostream &out, std::span<const Item> items, std::size_t per_line, std::string_view start,
+                Print print)
+{
+    for (std::size_t i = 0; i < items.size(); ++i)
+    {
+        out << (i % per_line == 0 ? start : ", ");
+        print(items[i]);
+        if (i % per_line == per_line - 1 || i + 1 == items.size())
+            out << '\n';
+    }
+}
+
+template <typename Cell>
+void emit_c(std::ostream &out, BFProgramView program, std::size_t tape_size, BFEofMode eof,
+            const BFBounds *bounds = nullptr)
+{
+    const char *const type = emit_c_cell_type<Cell>();
+    const auto &prefix = program.prefix;
+    const bool fits = emit_prefix_fits(program, tape_size);
+
+    out << "#include <stdint.h>\n"
+        << "#include <stdio.h>\n";
+    if (bounds)
+        out << "#include <stdlib.h>\n";
+
+    // the nonzero prefix cells as designated initializers
+    out << "\nstatic " << type << " tape[" << tape_size << "]";
+    if (prefix && fits && !prefix->cells.empty())
+    {
+        out << " = {\n";
+        std::size_t column = 0;
+        for (std::size_t i = 0; i < prefix->cells.size(); ++i)
+        {
+            const auto value = emit_cell_value<Cell>(prefix->cells[i]);
+            if (!value)
+                continue;
+
+            out << (column % 8 == 0 ? "    " : " ") << '[' << prefix->first + static_cast<std::int64_t>(i)
+                << "] = " << value << "u,";
+            if (++column % 8 == 0)
+                out << '\n';
+        }
+        if (column % 8 != 0)
+            out << '\n';
+        out << '}';
+    }
+    out << ";\n\n";
+
+    // octal escapes always take three digits, so no escape runs into the next character
+    if (prefix && !prefix->output.empty())
+    {
+        out << "static const char prefix_output[] =\n";
+        const auto bytes = std::span<const char>{prefix->output.data(), prefix->output.size()};
+        for (std::size_t i = 0; i < bytes.size(); i += 32)
+        {
+            out << "    \"";
+            for (const char byte : bytes.subspan(i, std::min<std::size_t>(32, bytes.size() - i)))
+            {
+                const auto code = static_cast<unsigned char>(byte);
+                if (code >= 0x20 && code < 0x7F && code != '"' && code != '\\' && code != '?')
+                    out << byte;
+                else
+                    out << '\\' << static_cast<char>('0' + (code >> 6)) << static_cast<char>('0' + ((code >> 3) & 7))
+                        << static_cast<char>('0' + (code & 7));
+            }
+            out << '"' << (i + 32 >= bytes.size() ? ";\n\n" : "\n");
+        }
+    }
+
+    if (bounds)
+        out << "static void check(const " << type << " *p, long long low, long long high)\n{\n"
+            << "    if (p - tape + low < 0)\n"
+            << "    {\n"
+            << "        fflush(stdout);\n"
+            << "        fputs(\"" << BF_EMIT_BELOW << "\", stderr);\n"
+            << "        exit(1);\n"
+            << "    }\n"
+            << "    if (p - tape + high >= " << tape_size << ")\n"
+            << "    {\n"
+            << "        fflush(stdout);\n"
+            << "        fputs(\"" << BF_EMIT_ABOVE << "\", stderr);\n"
+            << "        exit(1);\n"
+            << "    }\n"
+            << "}\n\n";
+
+    out << "int main(void)\n{\n"
+        << "    " << type << " *p = tape";
+    if (prefix && fits && prefix->pointer)
+        out << " + " << prefix->pointer;
+    out << ";\n"
+        << "    int c;\n";
+
+    if (prefix && !prefix->output.empty())
+        out << "    fwrite(prefix_output, 1, sizeof prefix_output - 1, stdout);\n";
+    if (!fits)
+        out << "    fputs(\"" << BF_EMIT_ABOVE << "\", stderr);\n"
+            << "    return 1;\n";
+
+    std::string indent(4, ' ');
+    const auto check = [&](const BFRangeCheck &range)
+    {
+        if (!range.empty())
+            out << indent << "check(p, " << range.low << ", " << range.high << ");\n";
+    };
+
+    // a loop checked once on entry is an if around a do-while, with the check between them
+    const auto entry_checked = [&](std::size_t begin)
+    { return bounds && !bounds->checks[begin].every_iteration && !bounds->checks[begin].empty(); };
+
+    if (bounds)
+        check(bounds->start);
+
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        const BFOp &op = program.ops[i];
+
+        switch (op.code)
+        {
+        case BFOpCode::ADD:
+            out << indent << "p[" << op.offset << "] += " << emit_cell_value<Cell>(op.arg) << "u;\n";
+            break;
+
+        case BFOpCode::SET:
+            out << indent << "p[" << op.offset << "] = " << emit_cell_value<Cell>(op.arg) << "u;\n";
+            break;
+
+        case BFOpCode::MOVE:
+            out << indent << "p += " << op.arg << ";\n";
+            break;
+
+        // the target may be off the tape where the loop never ran
+        case BFOpCode::MUL_ADD:
+            out << indent << "if (p[" << op.src << "])\n" << indent << "{\n";
+            indent.append(4, ' ');
+            if (bounds)
+                check(bounds->checks[i]);
+            out << indent << "p[" << op.offset << "] += p[" << op.src << "] * " << emit_cell_value<Cell>(op.arg)
+                << "u;\n";
+            indent.resize(indent.size() - 4);
+            out << indent << "}\n";
+            break;
+
+        // left to the C compiler to vectorize
+        case BFOpCode::ADD_VEC:
+            for (std::int32_t k = 0; k < op.arg; ++k)
+                if (const auto delta = emit_cell_value<Cell>(program.deltas[static_cast<std::size_t>(op.src + k)]))
+                    out << indent << "p[" << op.offset + k << "] += " << delta << "u;\n";
+            break;
+
+        case BFOpCode::OUT:
+            out << indent << "putchar((unsigned char)p[" << op.offset << "]);\n";
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::IN:
+            out << indent << "if ((c = getchar()) != EOF)\n"
+                << indent << "    p[" << op.offset << "] = (" << type << ")c;\n";
+            if (eof != BFEofMode::UNCHANGED)
+                out << indent << "else\n"
+                    << indent << "    p[" << op.offset << "] = " << (eof == BFEofMode::ZERO ? "0" : "-1") << ";\n";
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::LOOP_BEGIN:
+            if (entry_checked(i))
+            {
+                out << indent << "if (*p)\n"
+                    << indent << "{\n";
+                indent.append(4, ' ');
+                check(bounds->checks[i]);
+                out << indent << "do\n"
+                    << indent << "{\n";
+                indent.append(4, ' ');
+                break;
+            }
+
+            out << indent << "while (*p)\n"
+                << indent << "{\n";
+            indent.append(4, ' ');
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::LOOP_END:
+            indent.resize(indent.size() - 4);
+            if (entry_checked(op.jump))
+            {
+                out << indent << "} while (*p);\n";
+                indent.resize(indent.size() - 4);
+            }
+            out << indent << "}\n";
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::SCAN:
+            out << indent << "while (*p)\n"
+                << indent << "    p += " << op.arg << ";\n";
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::END:
+            out << indent << "return 0;\n";
+            break;
+        }
+    }
+
+    out << "}\n";
+}
+
+// a memory operand in Intel syntax, <size> ptr [rbx+disp]
+struct BFAsmCell
+{
+    const char *size;
+    std::int64_t disp;
+};
+
+inline std::ostream &operator<<(std::ostream &out, BFAsmCell cell)
+{
+    out << cell.size << " ptr [rbx";
+    if (cell.disp >= 0)
+        out << '+';
+    return out << cell.disp << ']';
+}
+
+// x86-64 System V assembly in GNU as Intel syntax, the tape pointer in rbx
+template <typename Cell>
+void emit_asm(std::ostream &out, BFProgramView program, std::size_t tape_size, BFEofMode eof,
+              const BFBounds *bounds = nullptr)
+{
+    constexpr std::int64_t WIDTH = sizeof(Cell);
+
+    // the operand size and the part of eax matching one cell
+    const char *const size = WIDTH == 1 ? "byte" : WIDTH == 2 ? "word" : "dword";
+    const char *const reg = WIDTH == 1 ? "al" : WIDTH == 2 ? "ax" : "eax";
+    const char *const load = WIDTH == 4 ? "mov" : "movzx";
+
+    const auto cell = [&](std::int32_t offset) { return BFAsmCell{size, offset * WIDTH}; };
+    const auto &prefix = program.prefix;
+    const bool fits = emit_prefix_fits(program, tape_size);
+
+    // rax is the first cell of the range, then one past the last
+    const auto check = [&](const BFRangeCheck &range)
+    {
+        if (range.empty())
+            return;
+
+        out << "    lea rax, [rbx" << (range.low >= 0 ? "+" : "") << range.low * WIDTH << "]\n"
+            << "    lea rcx, [rip + tape]\n"
+            << "    cmp rax, rcx\n"
+            << "    jb .Lbelow\n"
+            << "    lea rax, [rbx" << (range.high + 1 >= 0 ? "+" : "") << (range.high + 1) * WIDTH << "]\n"
+            << "    lea rcx, [rip + tape + " << tape_size * WIDTH << "]\n"
+            << "    cmp rax, rcx\n"
+            << "    ja .Labove\n";
+    };
+
+    out << "    .intel_syntax noprefix\n"
+        << "    .text\n"
+        << "    .globl main\n"
+        << "main:\n"
+        << "    push rbx\n";
+
+    // fwrite(prefix_output, 1, size, stdout)
+    if (prefix && !prefix->output.empty())
+        out << "    lea rdi, [rip + .Lprefix_output]\n"
+            << "    mov esi, 1\n"
+            << "    mov rdx, " << prefix->output.size() << '\n'
+            << "    mov rcx, qword ptr [rip + stdout@GOTPCREL]\n"
+            << "    mov rcx, qword ptr [rcx]\n"
+            << "    call fwrite@PLT\n";
+    if (!fits)
+        out << "    jmp .Labove\n";
+
+    out << "    lea rbx, [rip + tape" << BFAsmDisp{prefix && fits ? prefix->pointer * WIDTH : 0} << "]\n";
+
+    if (bounds)
+        check(bounds->start);
+
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        const BFOp &op = program.ops[i];
+
+        switch (op.code)
+        {
+        case BFOpCode::ADD:
+            out << "    add " << cell(op.offset) << ", " << emit_cell_value<Cell>(op.arg) << '\n';
+            break;
+
+        case BFOpCode::SET:
+            out << "    mov " << cell(op.offset) << ", " << emit_cell_value<Cell>(op.arg) << '\n';
+            break;
+
+        case BFOpCode::MOVE:
+            out << "    add rbx, " << op.arg * WIDTH << '\n';
+            break;
+
+        // the target may be off the tape where the loop never ran
+        case BFOpCode::MUL_ADD:
+            out << "    cmp " << cell(op.src) << ", 0\n"
+                << "    je .Lmul_" << i << '\n';
+            if (bounds)
+                check(bounds->checks[i]);
+            out << "    " << load << " eax, " << cell(op.src) << '\n'
+                << "    imul eax, eax, " << op.arg << '\n'
+                << "    add " << cell(op.offset) << ", " << reg << '\n'
+                << ".Lmul_" << i << ":\n";
+            break;
+
+        case BFOpCode::ADD_VEC:
+            for (std::int32_t k = 0; k < op.arg; ++k)
+                if (const auto delta = emit_cell_value<Cell>(program.deltas[static_cast<std::size_t>(op.src + k)]))
+                    out << "    add " << cell(op.offset + k) << ", " << delta << '\n';
+            break;
+
+        // the low byte of a cell is its first byte
+        case BFOpCode::OUT:
+            out << "    movzx edi, " << BFAsmCell{"byte", op.offset * WIDTH} << '\n'
+                << "    call putchar@PLT\n";
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        // getchar() returns the byte zero-extended, or -1 with all bits set
+        case BFOpCode::IN:
+            out << "    call getchar@PLT\n";
+            if (eof == BFEofMode::UNCHANGED)
+                out << "    cmp eax, -1\n"
+                    << "    je .Lin_" << i << '\n';
+            else if (eof == BFEofMode::ZERO)
+                out << "    cmp eax, -1\n"
+                    << "    mov edx, 0\n"
+                    << "    cmove eax, edx\n";
+            out << "    mov " << cell(op.offset) << ", " << reg << '\n'
+                << ".Lin_" << i << ":\n";
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        // a check on entry goes before the start of the body, one per iteration after it
+        case BFOpCode::LOOP_BEGIN:
+            out << "    cmp " << cell(0) << ", 0\n"
+                << "    je .Lend_" << i << '\n';
+            if (bounds && !bounds->checks[i].every_iteration)
+                check(bounds->checks[i]);
+            out << ".Lbody_" << i << ":\n";
+            if (bounds && bounds->checks[i].every_iteration)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::LOOP_END:
+            out << "    cmp " << cell(0) << ", 0\n"
+                << "    jne .Lbody_" << op.jump << '\n'
+                << ".Lend_" << op.jump << ":\n";
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::SCAN:
+            out << "    jmp .Lscan_" << i << '\n'
+                << ".Lstep_" << i << ":\n"
+                << "    add rbx, " << op.arg * WIDTH << '\n'
+                << ".Lscan_" << i << ":\n"
+                << "    cmp " << cell(0) << ", 0\n"
+                << "    jne .Lstep_" << i << '\n';
+            if (bounds)
+                check(bounds->checks[i]);
+            break;
+
+        case BFOpCode::END:
+            out << "    xor eax, eax\n"
+                << "    pop rbx\n"
+                << "    ret\n";
+            break;
+        }
+    }
+
+    // fflush(NULL); fputs(message, stderr); exit(1), the output so far goes out first
+    if (bounds || !fits)
+        out << ".Lbelow:\n"
+            << "    lea rdi, [rip + .Lbelow_message]\n"
+            << "    jmp .Lfault\n"
+            << ".Labove:\n"
+            << "    lea rdi, [rip + .Labove_message]\n"
+            << ".Lfault:\n"
+            << "    mov rbx, rdi\n"
+            << "    xor edi, edi\n"
+            << "    call fflush@PLT\n"
+            << "    mov rdi, rbx\n"
+            << "    mov rsi, qword ptr [rip + stderr@GOTPCREL]\n"
+            << "    mov rsi, qword ptr [rsi]\n"
+            << "    call fputs@PLT\n"
+            << "    mov edi, 1\n"
+            << "    call exit@PLT\n\n"
+            << "    .section .rodata\n"
+            << ".Lbelow_message:\n"
+            << "    .string \"" << BF_EMIT_BELOW << "\"\n"
+            << ".Labove_message:\n"
+            << "    .string \"" << BF_EMIT_ABOVE << "\"\n";
+
+    if (prefix && !prefix->output.empty())
+    {
+        out << "\n    .section .rodata\n"
+            << ".Lprefix_output:\n";
+        emit_lines(out, std::span<const char>{prefix->output.data(), prefix->output.size()}, 16, "    .byte ",
+                   [&](char byte) { out << static_cast<unsigned>(static_cast<unsigned char>(byte)); });
+    }
+
+    // the prefix cells, the zeroed rest of the tape around them
+    if (prefix && fits && !prefix->cells.empty())
+    {
+        const auto before = prefix->first * WIDTH;
+        const auto after = (static_cast<std::int64_t>(tape_size) - prefix->first -
+                            static_cast<std::int64_t>(prefix->cells.size())) *
+                           WIDTH;
+        const char *const directive = WIDTH == 1 ? "    .byte " : WIDTH == 2 ? "    .value " : "    .long ";
+
+        out << "\n    .data\n"
+            << "    .balign 16\n"
+            << "tape:\n";
+        if (before)
+            out << "    .zero " << before << '\n';
+        emit_lines(out, prefix->cells, 16, directive,
+                   [&](std::int32_t value) { out << emit_cell_value<Cell>(value); });
+        if (after)
+            out << "    .zero " << after << '\n';
+    }
+    else
+        out << "\n    .local tape\n"
+            << "    .comm tape, " << tape_size * WIDTH << ", 16\n";
+
+    out << "    .section .note.GNU-stack,\"\",@progbits\n";
+}
@@ -0,0 +1,1379 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "block.hpp"
+#include "bounds.hpp"
+#include "io.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
+#include "program.hpp"
+#include "scan.hpp"
+#include "stats.hpp"
+#include "tape.hpp"
+
+#if defined(__GNUC__)
+#define BF_HAS_COMPUTED_GOTO 1
+#else
+#define BF_HAS_COMPUTED_GOTO 0
+#endif
+
+enum class BFEngine
+{
+    SWITCH,   // one switch over the IR
+    THREADED, // direct-threaded code, the switch where labels-as-values are unavailable
+    JIT,      // native code, the threaded engine on unsupported platforms
+    TIERED    // threaded code that compiles hot loops to native code as it runs
+};
+
+// Hard limits on what the runs of an execution since its creation or
+// reset() may spend; a run that reaches one fails with a LIMIT error.
+// Zero is no limit.
+struct BFLimits
+{
+    std::uint64_t steps = 0;          // IR ops, counted as --stats counts them
+    std::chrono::milliseconds time{}; // wall-clock time from the first run on
+};
+
+struct BFRunOptions
+{
+    BFEngine engine = BFEngine::SWITCH;
+    std::size_t output_buffer = BFOutputBuffer::DEFAULT_CAPACITY; // 0 is unbuffered
+    BFEofMode eof = BFEofMode::UNCHANGED;
+    std::size_t tape_size = BFTape::DEFAULT_SIZE; // in cells
+    std::ostream *profile = nullptr;              // report here, null for none
+    std::string profile_folded;                   // folded stacks file, empty for none
+    bool check_bounds = !BF_HAS_GUARD_PAGES;      // check moves against the tape ends, see analyze_bounds()
+    bool stats = false;                           // count ops, loops and the tape extent
+    bool fed_input = false;                       // , reads what feed_input() gives, see BFRunState::INPUT
+    BFLimits limits;
+};
+
+// What a run may spend before it suspends, for time slicing executions:
+// the next run continues where the suspended one stopped.
+struct BFBudget
+{
+    static constexpr std::uint64_t UNLIMITED = std::numeric_limits<std::uint64_t>::max();
+
+    std::uint64_t steps = UNLIMITED; // IR ops, what is left of them once the run returns
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+enum class BFRunState
+{
+    FINISHED,  // the program reached its end
+    SUSPENDED, // at a loop back-edge, with the budget spent
+    INPUT      // at a , with fed input, none of it buffered
+};
+
+// One run of a program: the tape, the I/O buffers and whatever an engine
+// keeps between runs. run() continues from the current state and reset()
+// starts over, so one execution serves any number of runs of its program
+// without reserving a new tape. Executions of one program may run on
+// different threads, a single execution on one thread at a time.
+//
+// Cell is the unsigned type of one tape cell. Cells wrap modulo 2^bits,
+// . writes the low 8 bits of a cell and , stores the byte read
+// zero-extended, or all bits set for --eof=-1.
+//
+// stats() reports what the runs so far did. Runs, I/O and time are always
+// counted; ops, loop iterations and the tape extent only with the stats
+// option, whose engines count them (see BFStats).
+//
+// A run with a budget or limits charges loop iterations to a step budget
+// by their weights, see analyze_weights(), and looks at it at back-edges
+// only: once a slice of it is spent, preempt() moves over the next one,
+// or suspends the run there when the budget is spent or the deadline has
+// passed. Suspended runs are picked up by every engine, native loops of
+// the JIT and tiered engines included, at the iteration that was due.
+//
+// Runs with fed input are budgeted as well, and a , that finds nothing
+// buffered suspends the run before it reads, with BFRunState::INPUT. The
+// next run returns at once while nothing was fed, and reads otherwise:
+// the interpreters carry on after the ,, native code runs it again.
+//
+// snapshot() keeps the state runs continue from, and restore() takes any
+// number of executions of the program there, see Snapshot: a start that
+// all of them share runs once, and each restored tape is mapped from the
+// snapshot copy-on-write where tapes are shared (see BFTape).
+template <typename Cell = std::uint8_t>
+class BFExecution
+{
+    static_assert(std::is_unsigned_v<Cell> && sizeof(Cell) <= sizeof(std::uint32_t));
+    static_assert((3 * BFOp::MAX_REACH + BFOptimizer::VECTOR_CELLS) * sizeof(Cell) <= BFTape::GUARD_SIZE,
+                  "an op off the tape must land in the guard region");
+
+private:
+    BFCompiledProgram::Pointer m_program;
+    BFProgramView m_code;
+    BFRunOptions m_options;
+
+    BFTape m_tape;
+    Cell *m_ptr;
+    BFScanner<Cell> m_scanner;
+
+    BFInputBuffer m_input;
+    BFOutputBuffer m_output;
+
+    std::vector<Cell> m_deltas; // the program's ADD_VEC deltas at the cell width
+    bool m_prefix_pending = false; // the prefix output is still to be written
+    BFProfiler m_profiler;
+
+    BFCounters m_counters;
+    std::uint64_t m_runs = 0;
+    std::chrono::steady_clock::duration m_run_time{};
+    BFStats m_cleared; // the I/O counts of the buffers at the last clear_stats()
+    std::chrono::steady_clock::duration m_profile_time{}; // of the slices of the profiled run
+
+    // where a suspended run continues: the iteration of the loop whose
+    // LOOP_BEGIN is at op that was due, not yet charged its weight, or the
+    // , at op waiting for input
+    struct Suspension
+    {
+        std::size_t op;
+        std::uint32_t weight;
+        std::uint32_t code = 0;            // its body or , in the native code, 0 in interpreted code
+        std::optional<std::size_t> native; // the LOOP_BEGIN of the tiered loop running that code
+        bool input = false;
+    };
+
+    // the budget of the run under way, see preempt()
+    std::int64_t m_left = 0;     // steps left of the slice, charged by the engines
+    std::uint64_t m_reserve = 0; // steps left after it
+    std::uint64_t m_given = 0;   // steps the run started out with
+    std::chrono::steady_clock::time_point m_deadline;
+    std::optional<Suspension> m_suspension;
+
+    // what the runs since creation or reset() spent of the limits
+    std::uint64_t m_spent = 0;
+    std::optional<std::chrono::steady_clock::time_point> m_time_up;
+
+#if BF_HAS_COMPUTED_GOTO
+    // every op carries the address of its handler, so each handler ends in
+    // its own indirect jump to the next one
+    struct ThreadedOp
+    {
+        const void *handler;
+        std::int32_t arg;
+        std::int32_t offset;
+        std::int32_t src;
+        const ThreadedOp *target;
+    };
+
+    std::vector<ThreadedOp> m_threaded;
+    const void *const *m_handlers = nullptr; // of the run_threaded() m_threaded was built by
+    std::vector<std::uint32_t> m_back_edges; // of every LOOP_END, for the tiered engine
+#endif
+#if BF_HAS_JIT
+    std::vector<BFJitCode<Cell>> m_loops; // the loops the tiered engine compiled
+#endif
+
+    BFExecution(BFCompiledProgram::Pointer program, const BFRunOptions &options, std::istream &in,
+                std::ostream &out)
+        : m_program{std::move(program)},
+          m_code{m_program->code()},
+          m_options{options},
+          m_tape{tape_bytes(options.tape_size)},
+          m_ptr{reinterpret_cast<Cell *>(m_tape.data())},
+          m_scanner{reinterpret_cast<Cell *>(m_tape.data()), m_tape.size() / sizeof(Cell)},
+          m_input{options.fed_input ? nullptr : &in},
+          m_output{out, options.output_buffer}
+    {
+        bind_deltas();
+        apply_prefix();
+    }
+
+public:
+    using Pointer = std::unique_ptr<BFExecution>;
+
+    // What snapshot() keeps of an execution: its tape, the pages holding a
+    // nonzero cell, the pointer and a suspended run. Cheap to copy and
+    // never changed, so executions on any thread may be restored from it.
+    class Snapshot
+    {
+    private:
+        BFCompiledProgram::Pointer m_program;
+        std::shared_ptr<const BFTapeSnapshot> m_tape;
+        std::size_t m_pointer = 0; // cell
+        bool m_prefix_pending = false;
+        std::optional<Suspension> m_suspension;
+
+        // what the code of the suspended run depends on
+        BFEngine m_engine = BFEngine::SWITCH;
+        bool m_check_bounds = false;
+        bool m_stats = false;
+        bool m_profiled = false;
+
+        friend class BFExecution;
+
+    public:
+        [[nodiscard]] const BFTapeSnapshot &tape() const noexcept
+        {
+            return *m_tape;
+        }
+
+        [[nodiscard]] bool suspended() const noexcept
+        {
+            return m_suspension.has_value();
+        }
+    };
+
+    // back-edges after which the tiered engine compiles a loop
+    static constexpr std::uint32_t HOT_LOOP = 1000;
+
+    // steps between looks at the clock, in a run with a deadline
+    static constexpr std::int64_t TIME_SLICE = 1 << 16;
+
+    BFExecution(const BFExecution &) = delete;
+    BFExecution &operator=(const BFExecution &) = delete;
+
+    // fails only when the tape can't be reserved
+    [[nodiscard]] static std::expected<Pointer, BFError> create(BFCompiledProgram::Pointer program,
+                                                                const BFRunOptions &options = {},
+                                                                std::istream &in = std::cin,
+                                                                std::ostream &out = std::cout)
+    {
+        try
+        {
+            return Pointer{new BFExecution{std::move(program), options, in, out}};
+        }
+        catch (const std::bad_alloc &)
+        {
+            return std::unexpected{BFError{BFErrorCode::TAPE, "Could not reserve a tape of " +
+                                                                  std::to_string(options.tape_size) + " cells."}};
+        }
+    }
+
+    [[nodiscard]] const BFCompiledProgram &program() const noexcept
+    {
+        return *m_program;
+    }
+
+    // runs the program to its end, or with fed input until a , waits for
+    // it, output is flushed either way
+    [[nodiscard]] std::expected<void, BFError> run()
+    {
+        BFBudget budget;
+        if (auto ran = run(budget); !ran)
+            return std::unexpected{std::move(ran.error())};
+
+        return {};
+    }
+
+    // Runs the program to its end, or until the budget is spent and it
+    // suspends at the next loop back-edge; the run after that continues
+    // from there. The budget is only looked at on back-edges, so a run may
+    // go over it by the ops between two of them, fewer than the program
+    // has. Output is flushed either way. A run that reaches the limits of
+    // the options fails instead of suspending.
+    [[nodiscard]] std::expected<BFRunState, BFError> run(BFBudget &budget)
+    {
+        const bool resumed = m_suspension.has_value();
+        if (resumed && m_suspension->input && m_input.pending())
+        {
+            // still nothing to read, the time waited counts all the same
+            if (auto error = limit_error())
+            {
+                m_suspension.reset();
+                return std::unexpected{std::move(*error)};
+            }
+            return BFRunState::INPUT;
+        }
+
+        if (!resumed)
+        {
+            ++m_runs;
+            if (m_prefix_pending)
+            {
+                m_prefix_pending = false;
+                for (const char byte : m_code.prefix->output)
+                    m_output.put(static_cast<unsigned char>(byte));
+
+                if (!prefix_fits())
+                {
+                    m_output.flush();
+                    return std::unexpected{BFError{BFErrorCode::TAPE_OVERFLOW,
+                                                   "Tape pointer moved past the last cell, raise --tape-size."}};
+                }
+            }
+        }
+
+        const bool profiled = this->profiled();
+        if (profiled && !resumed)
+        {
+            m_profiler = BFProfiler{m_code.ops.size()};
+            m_profile_time = {};
+        }
+
+        if (m_options.stats && !resumed)
+            m_counters.ops += m_program->weights().top;
+
+        const auto start = std::chrono::steady_clock::now();
+        const bool limited = start_budget(budget, start, resumed);
+        const BFTapeFault fault = BFTape::guarded(
+            [&]
+            {
+                if (limited)
+                    run_instance<true>(profiled);
+                else
+                    run_instance<false>(profiled);
+            });
+        const auto end = std::chrono::steady_clock::now();
+        m_run_time += end - start;
+        m_profile_time += end - start;
+
+        if (limited)
+            settle_budget(budget);
+
+        // the program's own output comes first
+        m_output.flush();
+
+        if (fault != BFTapeFault::NONE)
+            m_suspension.reset();
+        if (fault == BFTapeFault::BELOW)
+            return std::unexpected{BFError{BFErrorCode::TAPE_UNDERFLOW, "Tape pointer moved below the first cell."}};
+        if (fault == BFTapeFault::ABOVE)
+            return std::unexpected{
+                BFError{BFErrorCode::TAPE_OVERFLOW, "Tape pointer moved past the last cell, raise --tape-size."}};
+
+        if (m_suspension)
+        {
+            if (auto error = limit_error())
+            {
+                m_suspension.reset();
+                return std::unexpected{std::move(*error)};
+            }
+            return m_suspension->input ? BFRunState::INPUT : BFRunState::SUSPENDED;
+        }
+
+        if (profiled)
+            if (auto reported = report(m_profile_time); !reported)
+                return std::unexpected{std::move(reported.error())};
+
+        return BFRunState::FINISHED;
+    }
+
+    [[nodiscard]] bool suspended() const noexcept
+    {
+        return m_suspension.has_value();
+    }
+
+    // the state the runs so far left, every cell of the tape and the index
+    // of the one the pointer is at
+    [[nodiscard]] std::span<const Cell> cells() const noexcept
+    {
+        return {reinterpret_cast<const Cell *>(m_tape.data()), m_tape.size() / sizeof(Cell)};
+    }
+
+    [[nodiscard]] std::size_t pointer() const noexcept
+    {
+        return static_cast<std::size_t>(m_ptr - reinterpret_cast<const Cell *>(m_tape.data()));
+    }
+
+    // what the runs since creation or clear_stats() did, see BFStats; the
+    // hook to scrape an execution that is kept for many runs
+    [[nodiscard]] BFStats stats() const noexcept
+    {
+        BFStats stats;
+        stats.runs = m_runs;
+        stats.ops = m_counters.ops;
+        stats.loop_iterations = m_counters.iterations;
+        stats.input_bytes = m_input.consumed() - m_cleared.input_bytes;
+        stats.output_bytes = m_output.written() - m_cleared.output_bytes;
+        stats.run_time = std::chrono::duration_cast<std::chrono::nanoseconds>(m_run_time);
+        stats.io_time = io_time() - m_cleared.io_time;
+
+        // without bounds checks, a run that faulted may have recorded the
+        // cells it was about to miss the tape by
+        const auto tape = reinterpret_cast<std::uintptr_t>(m_tape.data());
+        const std::uintptr_t low = std::max(m_counters.low, tape);
+        const std::uintptr_t high = std::min(m_counters.high, tape + m_tape.size());
+        if (low < high)
+        {
+            stats.tape_low = static_cast<std::int64_t>((low - tape) / sizeof(Cell));
+            stats.tape_high = static_cast<std::int64_t>((high - tape) / sizeof(Cell)) - 1;
+        }
+        return stats;
+    }
+
+    void clear_stats() noexcept
+    {
+        m_counters = BFCounters{};
+        m_runs = 0;
+        m_run_time = {};
+        m_cleared.input_bytes = m_input.consumed();
+        m_cleared.output_bytes = m_output.written();
+        m_cleared.io_time = io_time();
+    }
+
+    // Runs another program from the current tape, pointer and I/O on, for
+    // programs that arrive in pieces. What the engines kept for the old
+    // program is dropped, and so are its prefix and a suspended run; what
+    // was spent of the limits is kept.
+    void set_program(BFCompiledProgram::Pointer program)
+    {
+        m_program = std::move(program);
+        m_code = m_program->code();
+        bind_deltas();
+        m_prefix_pending = false;
+        m_suspension.reset();
+
+#if BF_HAS_COMPUTED_GOTO
+        m_threaded.clear();
+        m_back_edges.clear();
+#endif
+#if BF_HAS_JIT
+        m_loops.clear();
+#endif
+    }
+
+    // back to a zeroed tape at the first cell, or the state the program's
+    // prefix left, with no input buffered, no run suspended and nothing
+    // spent of the limits
+    void reset() noexcept
+    {
+        m_tape.clear();
+        m_ptr = reinterpret_cast<Cell *>(m_tape.data());
+        m_input.reset();
+        apply_prefix();
+        m_suspension.reset();
+        m_spent = 0;
+        m_time_up.reset();
+    }
+
+    // the same, reading and writing other streams from now on
+    void reset(std::istream &in, std::ostream &out)
+    {
+        reset();
+        m_input.reset(&in);
+        m_output.reset(out);
+    }
+
+    // The state the next run continues from, see Snapshot. Output already
+    // written, buffered input and what was spent of the limits are not
+    // part of it. Fails when the tape's pages can't be kept, and for a run
+    // suspended in a native loop of the tiered engine, which only this
+    // execution has compiled.
+    [[nodiscard]] std::expected<Snapshot, BFError> snapshot() const
+    {
+        if (m_suspension && m_suspension->native)
+            return std::unexpected{BFError{BFErrorCode::SNAPSHOT,
+                                           "Could not snapshot a run suspended in a tiered native loop."}};
+
+        Snapshot snapshot;
+        try
+        {
+            snapshot.m_tape = m_tape.snapshot();
+        }
+        catch (const std::bad_alloc &)
+        {
+            return std::unexpected{BFError{BFErrorCode::SNAPSHOT, "Could not keep the tape of the snapshot."}};
+        }
+
+        snapshot.m_program = m_program;
+        snapshot.m_pointer = pointer();
+        snapshot.m_prefix_pending = m_prefix_pending;
+        snapshot.m_suspension = m_suspension;
+        snapshot.m_engine = m_options.engine;
+        snapshot.m_check_bounds = m_options.check_bounds;
+        snapshot.m_stats = m_options.stats;
+        snapshot.m_profiled = profiled();
+        return snapshot;
+    }
+
+    // Back to the state of a snapshot, as reset() goes back to the start:
+    // no input buffered, nothing spent of the limits, and a suspended run
+    // continues with the next run. The snapshot has to be of the same
+    // program and tape size, and one of a suspended run of an execution
+    // with the same engine, bounds checks, stats and profiling, whose code
+    // it continues in. Fails with the execution as it was when it doesn't
+    // fit, and reset when the tape can't be mapped.
+    [[nodiscard]] std::expected<void, BFError> restore(const Snapshot &snapshot)
+    {
+        if (snapshot.m_program != m_program || snapshot.m_tape->size() != m_tape.size())
+            return std::unexpected{
+                BFError{BFErrorCode::SNAPSHOT, "The snapshot is of another program or tape size."}};
+
+        if (snapshot.m_suspension &&
+            (snapshot.m_engine != m_options.engine || snapshot.m_check_bounds != m_options.check_bounds ||
+             snapshot.m_stats != m_options.stats || snapshot.m_profiled != profiled()))
+            return std::unexpected{
+                BFError{BFErrorCode::SNAPSHOT, "The snapshot's suspended run is of another engine."}};
+
+        try
+        {
+            m_tape.restore(*snapshot.m_tape);
+        }
+        catch (const std::bad_alloc &)
+        {
+            reset();
+            return std::unexpected{BFError{BFErrorCode::SNAPSHOT, "Could not map the tape of the snapshot."}};
+        }
+
+        m_ptr = reinterpret_cast<Cell *>(m_tape.data()) + snapshot.m_pointer;
+        m_input.reset();
+        m_prefix_pending = snapshot.m_prefix_pending;
+        m_suspension = snapshot.m_suspension;
+        m_spent = 0;
+        m_time_up.reset();
+
+        // the profile of a continued run starts here
+        if (m_suspension && profiled())
+        {
+            m_profiler = BFProfiler{m_code.ops.size()};
+            m_profile_time = {};
+        }
+        return {};
+    }
+
+    // the same, reading and writing other streams from now on
+    [[nodiscard]] std::expected<void, BFError> restore(const Snapshot &snapshot, std::istream &in, std::ostream &out)
+    {
+        auto restored = restore(snapshot);
+        if (restored)
+        {
+            m_input.reset(&in);
+            m_output.reset(out);
+        }
+        return restored;
+    }
+
+    // Where fed input goes, see BFInputBuffer::space(): the caller copies
+    // or reads up to its size into it and commits what it put there. Empty
+    // while the buffer is full.
+    [[nodiscard]] std::span<char> input_space() noexcept
+    {
+        return m_input.space();
+    }
+
+    void commit_input(std::size_t bytes) noexcept
+    {
+        m_input.commit(bytes);
+    }
+
+    // no more fed input, , sees the end of it once the buffer is drained
+    void close_input() noexcept
+    {
+        m_input.close();
+    }
+
+private:
+    [[nodiscard]] static std::size_t tape_bytes(std::size_t cells)
+    {
+        if (cells > std::numeric_limits<std::size_t>::max() / sizeof(Cell))
+            throw std::bad_alloc{};
+
+        return cells * sizeof(Cell);
+    }
+
+    [[nodiscard]] std::chrono::nanoseconds io_time() const noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(m_input.waited() + m_output.waited());
+    }
+
+    [[nodiscard]] bool profiled() const noexcept
+    {
+        return m_options.profile || !m_options.profile_folded.empty();
+    }
+
+    [[nodiscard]] bool prefix_fits() const noexcept
+    {
+        return m_code.prefix->reach <= static_cast<std::int64_t>(m_tape.size() / sizeof(Cell));
+    }
+
+    // Starts the tape from the state of the prefix, if the program has one.
+    // A prefix that doesn't fit the tape leaves it zeroed, and the next
+    // run() fails after writing the prefix output, where the evaluated
+    // start would have left the tape.
+    void apply_prefix() noexcept
+    {
+        m_prefix_pending = m_code.prefix.has_value();
+        if (!m_prefix_pending || !prefix_fits())
+            return;
+
+        const BFPrefixView &prefix = *m_code.prefix;
+        Cell *const tape = reinterpret_cast<Cell *>(m_tape.data());
+        for (std::size_t i = 0; i < prefix.cells.size(); ++i)
+            tape[static_cast<std::size_t>(prefix.first) + i] = static_cast<Cell>(prefix.cells[i]);
+        m_ptr = tape + prefix.pointer;
+    }
+
+    // Sets up the step budget of a run from budget and the limits; false
+    // when neither bounds the run, it doesn't continue a suspended one and
+    // input isn't fed, which leaves the budget out of it. A new run is charged its top-level
+    // ops up front.
+    [[nodiscard]] bool start_budget(const BFBudget &budget, std::chrono::steady_clock::time_point now, bool resumed)
+    {
+        const BFLimits &limits = m_options.limits;
+        if (limits.time.count() > 0 && !m_time_up)
+        {
+            using Duration = std::chrono::steady_clock::duration;
+            const Duration most = std::chrono::steady_clock::time_point::max() - now;
+            m_time_up = now + (limits.time < std::chrono::duration_cast<std::chrono::milliseconds>(most)
+                                   ? std::chrono::duration_cast<Duration>(limits.time)
+                                   : most);
+        }
+
+        m_reserve = budget.steps;
+        if (limits.steps)
+            m_reserve = std::min(m_reserve, limits.steps - std::min(limits.steps, m_spent));
+        m_deadline = m_time_up ? std::min(budget.deadline, *m_time_up) : budget.deadline;
+
+        if (!resumed && !m_input.fed() && m_reserve == BFBudget::UNLIMITED &&
+            m_deadline == std::chrono::steady_clock::time_point::max())
+            return false;
+
+        m_given = m_reserve;
+        m_left = resumed ? 0 : -static_cast<std::int64_t>(m_program->weights().top);
+        return true;
+    }
+
+    // counts what the run spent against the limits and takes it off budget
+    void settle_budget(BFBudget &budget) noexcept
+    {
+        const std::uint64_t taken = m_given - m_reserve;
+        const std::uint64_t spent =
+            m_left >= 0 ? taken - static_cast<std::uint64_t>(m_left) : taken + static_cast<std::uint64_t>(-m_left);
+
+        m_spent += spent;
+        if (budget.steps != BFBudget::UNLIMITED)
+            budget.steps -= std::min(budget.steps, spent);
+    }
+
+    // for a run suspended by the limits rather than by its budget
+    [[nodiscard]] std::optional<BFError> limit_error() const
+    {
+        const BFLimits &limits = m_options.limits;
+        if (limits.steps && m_spent + m_suspension->weight > limits.steps)
+            return BFError{BFErrorCode::LIMIT,
+                           "Step limit of " + std::to_string(limits.steps) + " ops reached, raise --max-steps."};
+        if (m_time_up && std::chrono::steady_clock::now() >= *m_time_up)
+            return BFError{BFErrorCode::LIMIT, "Time limit of " + std::to_string(limits.time.count()) +
+                                                   " ms reached, raise --time-limit."};
+
+        return std::nullopt;
+    }
+
+    // Called by the engines when charging weight at a back-edge took left
+    // below zero. Moves the next slice of the budget into left, or undoes
+    // the charge and returns false to suspend the run when the rest of the
+    // budget can't pay for it or the deadline has passed. The clock is read
+    // once per TIME_SLICE steps.
+    [[nodiscard]] bool preempt(std::int64_t &left, std::uint32_t weight)
+    {
+        const bool timed = m_deadline != std::chrono::steady_clock::time_point::max();
+        const auto owed = static_cast<std::uint64_t>(-left);
+        if (owed > m_reserve || (timed && std::chrono::steady_clock::now() >= m_deadline))
+        {
+            left += weight;
+            return false;
+        }
+
+        const std::uint64_t slice = timed ? TIME_SLICE : std::numeric_limits<std::int64_t>::max() / 2;
+        const std::uint64_t take = std::min(m_reserve, std::max(slice, owed));
+        m_reserve -= take;
+        left += static_cast<std::int64_t>(take);
+        return true;
+    }
+
+    // charges an iteration at a back-edge, false where the run suspends
+    [[nodiscard]] bool charge(std::int64_t &left, std::uint32_t weight)
+    {
+        left -= weight;
+        return left >= 0 || preempt(left, weight);
+    }
+
+    // Picks a suspended run up in interpreted code: charges the iteration
+    // that was due and counts and checks it as its back-edge would have,
+    // or reads what the , waited for and checks what follows it. Returns
+    // the op to carry on after, the LOOP_BEGIN of the body or the ,.
+    template <bool CHECKED, bool STATS>
+    [[nodiscard]] std::size_t resume(Cell *ptr, std::int64_t &left)
+    {
+        const Suspension suspension = *std::exchange(m_suspension, std::nullopt);
+        if (suspension.input)
+        {
+            read_byte(ptr[m_code.ops[suspension.op].offset]);
+            if constexpr (CHECKED || STATS)
+                check<CHECKED, STATS>(ptr, m_program->bounds().checks[suspension.op]);
+            return suspension.op;
+        }
+
+        left -= suspension.weight;
+        if constexpr (STATS)
+            count(suspension.weight);
+        if constexpr (CHECKED || STATS)
+            if (const BFRangeCheck &range = m_program->bounds().checks[suspension.op]; range.every_iteration)
+                check<CHECKED, STATS>(ptr, range);
+
+        return suspension.op;
+    }
+
+    void bind_deltas()
+    {
+        m_deltas.clear();
+        for (const std::int32_t delta : m_code.deltas)
+            m_deltas.push_back(static_cast<Cell>(delta));
+    }
+
+    template <bool LIMITED>
+    void run_instance(bool profiled)
+    {
+        if (m_options.stats && m_options.check_bounds)
+            run_engine<true, true, LIMITED>(profiled);
+        else if (m_options.stats)
+            run_engine<false, true, LIMITED>(profiled);
+        else if (m_options.check_bounds)
+            run_engine<true, false, LIMITED>(profiled);
+        else
+            run_engine<false, false, LIMITED>(profiled);
+    }
+
+    // CHECKED builds the engines with the bounds checks of analyze_bounds(),
+    // STATS with the counters of BFCounters, the tape extent taken where the
+    // checks would be, LIMITED with the step budget
+    template <bool CHECKED, bool STATS, bool LIMITED>
+    void run_engine(bool profiled)
+    {
+        // the switch engine instrumented, whatever the engine option says
+        if (profiled)
+        {
+            run_switch<true, CHECKED, STATS, LIMITED>();
+            return;
+        }
+
+        switch (m_options.engine)
+        {
+        case BFEngine::SWITCH:
+            run_switch<false, CHECKED, STATS, LIMITED>();
+            break;
+
+        case BFEngine::THREADED:
+            run_threaded<false, CHECKED, STATS, LIMITED>();
+            break;
+
+        case BFEngine::JIT:
+            run_jit<CHECKED, STATS, LIMITED>();
+            break;
+
+        case BFEngine::TIERED:
+            run_threaded<true, CHECKED, STATS, LIMITED>();
+            break;
+        }
+    }
+
+    // CHECKED faults like the guard regions when the cells of range aren't
+    // all on the tape. STATS records the range as reached, once it passed.
+    template <bool CHECKED, bool STATS>
+    void check(const Cell *ptr, const BFRangeCheck &range) noexcept
+    {
+        if (range.empty())
+            return;
+
+        if constexpr (CHECKED)
+        {
+            const std::ptrdiff_t cell = ptr - reinterpret_cast<const Cell *>(m_tape.data());
+            if (cell + range.low < 0)
+                BFTape::fault(BFTapeFault::BELOW);
+            if (cell + range.high >= static_cast<std::ptrdiff_t>(m_tape.size() / sizeof(Cell)))
+                BFTape::fault(BFTapeFault::ABOVE);
+        }
+
+        if constexpr (STATS)
+            m_counters.extend(reinterpret_cast<std::uintptr_t>(ptr + range.low),
+                              reinterpret_cast<std::uintptr_t>(ptr + range.high + 1));
+    }
+
+    // an iteration of a loop body starts, weight from BFWeights
+    void count(std::uint32_t weight) noexcept
+    {
+        m_counters.ops += weight;
+        ++m_counters.iterations;
+    }
+
+    [[nodiscard]] std::expected<void, BFError> report(std::chrono::steady_clock::duration total)
+    {
+        m_profiler.set_total(total);
+
+        if (m_options.profile)
+            m_profiler.report(*m_options.profile, m_code);
+
+        if (!m_options.profile_folded.empty())
+        {
+            std::ofstream folded{m_options.profile_folded};
+            m_profiler.write_folded(folded, m_code);
+            if (!folded)
+                return std::unexpected{BFError{BFErrorCode::IO, "Could not write " + m_options.profile_folded + "."}};
+        }
+
+        return {};
+    }
+
+    // PROFILE builds the instrumented engine behind --profile, a separate
+    // instantiation so the normal one carries no trace of it
+    template <bool PROFILE = false, bool CHECKED = false, bool STATS = false, bool LIMITED = false>
+    void run_switch()
+    {
+        const BFOp *const ops = m_code.ops.data();
+        const BFRangeCheck *checks = nullptr;
+        if constexpr (CHECKED || STATS)
+            checks = m_program->bounds().checks.data();
+
+        const std::uint32_t *weights = nullptr;
+        if constexpr (STATS || LIMITED)
+            weights = m_program->weights().loops.data();
+
+        const BFOp *op = ops;
+        if (LIMITED && m_suspension)
+            op += resume<CHECKED, STATS>(m_ptr, m_left) + 1;
+        else if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(m_ptr, m_program->bounds().start);
+
+        for (;; ++op)
+        {
+            if constexpr (PROFILE)
+                m_profiler.count(static_cast<std::size_t>(op - ops));
+
+            switch (op->code)
+            {
+            case BFOpCode::ADD:
+                m_ptr[op->offset] += static_cast<Cell>(op->arg);
+                break;
+
+            case BFOpCode::MOVE:
+                m_ptr += op->arg;
+                break;
+
+            case BFOpCode::OUT:
+                m_output.put(static_cast<unsigned char>(m_ptr[op->offset]));
+                if constexpr (CHECKED || STATS)
+                    check<CHECKED, STATS>(m_ptr, checks[op - ops]);
+                break;
+
+            case BFOpCode::IN:
+                if constexpr (LIMITED)
+                    if (m_input.pending())
+                    {
+                        m_suspension = Suspension{static_cast<std::size_t>(op - ops), 0, 0, std::nullopt, true};
+                        return;
+                    }
+
+                read_byte(m_ptr[op->offset]);
+                if constexpr (CHECKED || STATS)
+                    check<CHECKED, STATS>(m_ptr, checks[op - ops]);
+                break;
+
+            // jump onto the matching LOOP_END, the loop increment then steps
+            // past it; the check is on entering the body, or the one after the loop
+            case BFOpCode::LOOP_BEGIN:
+                if (*m_ptr == 0)
+                    op = ops + op->jump;
+                else
+                {
+                    if constexpr (PROFILE)
+                        m_profiler.enter_loop(static_cast<std::size_t>(op - ops));
+                    if constexpr (STATS)
+                        count(weights[op - ops]);
+                    if constexpr (LIMITED)
+                        m_left -= weights[op - ops];
+                }
+                if constexpr (CHECKED || STATS)
+                    check<CHECKED, STATS>(m_ptr, checks[op - ops]);
+                break;
+
+            // jump onto the matching LOOP_BEGIN, the loop increment then steps into the body
+            case BFOpCode::LOOP_END:
+                if (*m_ptr)
+                {
+                    if constexpr (LIMITED)
+                        if (!charge(m_left, weights[op->jump]))
+                        {
+                            m_suspension = Suspension{op->jump, weights[op->jump]};
+                            return;
+                        }
+
+                    op = ops + op->jump;
+                    if constexpr (STATS)
+                        count(weights[op - ops]);
+                    if constexpr (CHECKED || STATS)
+                        if (checks[op - ops].every_iteration)
+                            check<CHECKED, STATS>(m_ptr, checks[op - ops]);
+                }
+                else
+                {
+                    if constexpr (PROFILE)
+                        m_profiler.leave_loop();
+                    if constexpr (CHECKED || STATS)
+                        check<CHECKED, STATS>(m_ptr, checks[op - ops]);
+                }
+                break;
+
+            case BFOpCode::SET:
+                m_ptr[op->offset] = static_cast<Cell>(op->arg);
+                break;
+
+            case BFOpCode::SCAN:
+                m_ptr = m_scanner.find_zero(m_ptr, op->arg);
+                if constexpr (CHECKED || STATS)
+                    check<CHECKED, STATS>(m_ptr, checks[op - ops]);
+                break;
+
+            // the target is only touched, and checked, where the loop ran
+            case BFOpCode::MUL_ADD:
+                if (const Cell factor = m_ptr[op->src])
+                {
+                    if constexpr (CHECKED || STATS)
+                        check<CHECKED, STATS>(m_ptr, checks[op - ops]);
+                    m_ptr[op->offset] += product(factor, op->arg);
+                }
+                break;
+
+            case BFOpCode::ADD_VEC:
+                add_block(m_ptr + op->offset, m_deltas.data() + op->src, static_cast<std::size_t>(op->arg));
+                break;
+
+            case BFOpCode::END:
+                return;
+
+            default:
+                std::unreachable();
+            }
+        }
+    }
+
+#if BF_HAS_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+    // TIERED counts the back-edges of every loop and once there are
+    // HOT_LOOP of them compiles the loop, runs the rest of it natively and
+    // has its LOOP_BEGIN enter the native loop from then on. Nested loops
+    // tier up on their own first, then again as part of the outer one.
+    // CHECKED, STATS and LIMITED find the check and the weight of an op by
+    // its index, as in run_switch().
+    template <bool TIERED = false, bool CHECKED = false, bool STATS = false, bool LIMITED = false>
+    void run_threaded()
+    {
+        // indexed by BFOpCode
+        static constexpr const void *HANDLERS[] = {
+            &&op_add, &&op_move, &&op_out, &&op_in, &&op_loop_begin,
+            TIERED ? &&op_loop_end_counted : &&op_loop_end, &&op_set, &&op_scan, &&op_mul_add, &&op_add_vec, &&op_end};
+
+        // built on the first run and kept, a faulting run leaves nothing to
+        // free; built again for runs of another instantiation, with or
+        // without the budget, whose native loops are of their own kind too
+        std::vector<ThreadedOp> &code = m_threaded;
+        if (code.empty() || m_handlers != HANDLERS)
+        {
+            code.resize(m_code.ops.size());
+            for (std::size_t i = 0; i < code.size(); ++i)
+            {
+                const BFOp &op = m_code.ops[i];
+                code[i] = ThreadedOp{HANDLERS[static_cast<std::size_t>(op.code)], op.arg, op.offset, op.src,
+                                     code.data() + op.jump};
+            }
+            m_handlers = HANDLERS;
+
+            if (TIERED)
+            {
+                m_back_edges.assign(code.size(), 0);
+#if BF_HAS_JIT
+                m_loops.clear();
+#endif
+            }
+        }
+
+        Cell *ptr = m_ptr;
+        std::int64_t left = m_left;
+        const Cell *const deltas = m_deltas.data();
+        const ThreadedOp *op = code.data();
+#if BF_HAS_JIT
+        const BFJitCallbacks callbacks = jit_callbacks();
+#endif
+
+        const BFRangeCheck *checks = nullptr;
+        if constexpr (CHECKED || STATS)
+            checks = m_program->bounds().checks.data();
+
+        const std::uint32_t *weights = nullptr;
+        if constexpr (STATS || LIMITED)
+            weights = m_program->weights().loops.data();
+
+        // the check and the weight of the op at hand
+        const auto checked = [&]() -> const BFRangeCheck & { return checks[op - code.data()]; };
+        const auto weight = [&] { return weights[op - code.data()]; };
+
+        // stops at the back-edge at hand, its LOOP_BEGIN's iteration due
+        const auto suspend = [&]
+        {
+            const auto loop = static_cast<std::size_t>(op->target - code.data());
+            m_suspension = Suspension{loop, weights[loop]};
+            m_ptr = ptr;
+            m_left = left;
+        };
+
+#if BF_HAS_JIT
+        // runs a native loop of the tiered engine, whose LOOP_BEGIN is op,
+        // false when it suspended
+        const auto run_native = [&](const BFJitCode<Cell> &loop, const BFJitCallbacks &with)
+        {
+            if constexpr (LIMITED)
+                m_left = left;
+
+            ptr = loop.run(ptr, with);
+            if constexpr (LIMITED)
+            {
+                left = m_left;
+                if (m_suspension)
+                {
+                    const auto begin = static_cast<std::size_t>(op - code.data());
+                    m_suspension->op += begin;
+                    m_suspension->native = begin;
+                    m_ptr = ptr;
+                    return false;
+                }
+            }
+
+            return true;
+        };
+#endif
+
+#define BF_DISPATCH() goto *(++op)->handler
+
+        if (LIMITED && m_suspension)
+        {
+#if BF_HAS_JIT
+            if (m_suspension->native)
+            {
+                // charged here, the native body counts and checks it
+                op = code.data() + *m_suspension->native;
+                BFJitCallbacks resumed = callbacks;
+                resumed.resume = m_suspension->code;
+                left -= m_suspension->weight;
+                m_suspension.reset();
+
+                if (!run_native(m_loops[static_cast<std::size_t>(op->arg)], resumed))
+                    return;
+                goto op_native_done;
+            }
+#endif
+            op = code.data() + resume<CHECKED, STATS>(ptr, left);
+            BF_DISPATCH();
+        }
+
+        if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, m_program->bounds().start);
+        goto *op->handler;
+
+    op_add:
+        ptr[op->offset] += static_cast<Cell>(op->arg);
+        BF_DISPATCH();
+
+    op_move:
+        ptr += op->arg;
+        BF_DISPATCH();
+
+    op_out:
+        m_output.put(static_cast<unsigned char>(ptr[op->offset]));
+        if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, checked());
+        BF_DISPATCH();
+
+    op_in:
+        if constexpr (LIMITED)
+            if (m_input.pending())
+            {
+                m_suspension = Suspension{static_cast<std::size_t>(op - code.data()), 0, 0, std::nullopt, true};
+                m_ptr = ptr;
+                m_left = left;
+                return;
+            }
+
+        read_byte(ptr[op->offset]);
+        if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, checked());
+        BF_DISPATCH();
+
+    op_loop_begin:
+        if (*ptr == 0)
+            op = op->target;
+        else
+        {
+            if constexpr (STATS)
+                count(weight());
+            if constexpr (LIMITED)
+                left -= weight();
+        }
+        if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, checked());
+        BF_DISPATCH();
+
+    op_loop_end:
+        if (*ptr)
+        {
+            if constexpr (LIMITED)
+                if (!charge(left, weights[op->target - code.data()]))
+                {
+                    suspend();
+                    return;
+                }
+
+            op = op->target;
+            if constexpr (STATS)
+                count(weight());
+            if constexpr (CHECKED || STATS)
+                if (checked().every_iteration)
+                    check<CHECKED, STATS>(ptr, checked());
+        }
+        else if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, checked());
+        BF_DISPATCH();
+
+    op_loop_end_counted:
+#if BF_HAS_JIT
+        if (*ptr)
+        {
+            const auto end = static_cast<std::size_t>(op - code.data());
+            if (++m_back_edges[end] == HOT_LOOP)
+            {
+                // counted or not, the loop only comes back here if it fails to compile
+                code[end].handler = &&op_loop_end;
+
+                const auto begin = static_cast<std::size_t>(op->target - code.data());
+                if (const BFJitCode<Cell> *loop = compile_loop(begin, LIMITED))
+                {
+                    code[begin].handler = &&op_native;
+                    code[begin].arg = static_cast<std::int32_t>(m_loops.size() - 1);
+
+                    // the native loop tests the cell again, still nonzero, and
+                    // carries on, counting and charging the iteration itself
+                    op = op->target;
+                    if (!run_native(*loop, callbacks))
+                        return;
+                    goto op_native_done;
+                }
+            }
+
+            if constexpr (LIMITED)
+                if (!charge(left, weights[op->target - code.data()]))
+                {
+                    suspend();
+                    return;
+                }
+
+            op = op->target;
+            if constexpr (STATS)
+                count(weight());
+            if constexpr (CHECKED || STATS)
+                if (checked().every_iteration)
+                    check<CHECKED, STATS>(ptr, checked());
+        }
+        else if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, checked());
+        BF_DISPATCH();
+
+    op_native:
+        if (!run_native(m_loops[static_cast<std::size_t>(op->arg)], callbacks))
+            return;
+    op_native_done:
+        op = op->target;
+        if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, checked());
+        BF_DISPATCH();
+#else
+        goto op_loop_end;
+#endif
+
+    op_set:
+        ptr[op->offset] = static_cast<Cell>(op->arg);
+        BF_DISPATCH();
+
+    op_scan:
+        ptr = m_scanner.find_zero(ptr, op->arg);
+        if constexpr (CHECKED || STATS)
+            check<CHECKED, STATS>(ptr, checked());
+        BF_DISPATCH();
+
+    op_mul_add:
+        if (const Cell factor = ptr[op->src])
+        {
+            if constexpr (CHECKED || STATS)
+                check<CHECKED, STATS>(ptr, checked());
+            ptr[op->offset] += product(factor, op->arg);
+        }
+        BF_DISPATCH();
+
+    op_add_vec:
+        add_block(ptr + op->offset, deltas + op->src, static_cast<std::size_t>(op->arg));
+        BF_DISPATCH();
+
+    op_end:
+        m_ptr = ptr;
+        m_left = left;
+
+#undef BF_DISPATCH
+    }
+#pragma GCC diagnostic pop
+#else
+    template <bool TIERED = false, bool CHECKED = false, bool STATS = false, bool LIMITED = false>
+    void run_threaded()
+    {
+        run_switch<false, CHECKED, STATS, LIMITED>();
+    }
+#endif
+
+    // the product is taken in 32 bits so narrow cells can't overflow int
+    [[nodiscard]] static Cell product(Cell value, std::int32_t factor) noexcept
+    {
+        return static_cast<Cell>(static_cast<std::uint32_t>(value) * static_cast<std::uint32_t>(factor));
+    }
+
+    void read_byte(Cell &cell)
+    {
+        // pending output goes out before waiting on input, so prompts show up
+        if (!m_input.buffered())
+            m_output.flush();
+
+        const int c = m_input.get();
+        if (c >= 0)
+            cell = static_cast<Cell>(c);
+        else if (m_options.eof == BFEofMode::ZERO)
+            cell = 0;
+        else if (m_options.eof == BFEofMode::MINUS_ONE)
+            cell = static_cast<Cell>(-1);
+    }
+
+#if BF_HAS_JIT
+    template <bool CHECKED, bool STATS, bool LIMITED>
+    void run_jit()
+    {
+        const BFJitCode<Cell> *code = m_program->template jit<Cell>(jit_mode(), LIMITED);
+        if (!code)
+        {
+            run_threaded<false, CHECKED, STATS, LIMITED>();
+            return;
+        }
+
+        BFJitCallbacks callbacks = jit_callbacks();
+        if (LIMITED && m_suspension)
+        {
+            callbacks.resume = m_suspension->code;
+            m_left -= m_suspension->weight;
+            m_suspension.reset();
+        }
+
+        m_ptr = code->run(m_ptr, callbacks);
+    }
+
+    // the machine code matching the instantiation run_engine() picks
+    [[nodiscard]] BFJitMode jit_mode() const noexcept
+    {
+        if (m_options.stats)
+            return m_options.check_bounds ? BFJitMode::CHECKED_STATS : BFJitMode::STATS;
+        return m_options.check_bounds ? BFJitMode::CHECKED : BFJitMode::PLAIN;
+    }
+
+    [[nodiscard]] BFJitCallbacks jit_callbacks() noexcept
+    {
+        return BFJitCallbacks{this,
+                              jit_out,
+                              jit_in,
+                              jit_scan,
+                              jit_fault,
+                              m_tape.data(),
+                              m_tape.data() + m_tape.size() / sizeof(Cell) * sizeof(Cell),
+                              &m_counters,
+                              jit_preempt,
+                              &m_left,
+                              0};
+    }
+
+    // The loop at begin as native code of its own, null when it can't be
+    // made or isn't worth it: a loop spending its time in . and , loses
+    // more to calling back out of native code than it gains.
+    [[nodiscard]] const BFJitCode<Cell> *compile_loop(std::size_t begin, bool preemptible)
+    {
+        const std::size_t end = m_code.ops[begin].jump;
+        std::size_t io = 0;
+        for (std::size_t i = begin; i <= end; ++i)
+            io += m_code.ops[i].code == BFOpCode::IN || m_code.ops[i].code == BFOpCode::OUT;
+        if (4 * io >= end - begin + 1)
+            return nullptr;
+
+        BFArenaScope arena;
+        auto loop = BFJitCode<Cell>::compile_loop(m_code, begin, jit_mode(), preemptible, arena.resource());
+        if (!loop)
+            return nullptr;
+
+        m_loops.push_back(std::move(*loop));
+        return &m_loops.back();
+    }
+
+    static void jit_out(void *self, std::uint32_t value)
+    {
+        static_cast<BFExecution *>(self)->m_output.put(static_cast<unsigned char>(value));
+    }
+
+    // -1 with the run suspended where preemptible code waits for fed input
+    static std::int64_t jit_in(void *self, std::uint32_t current, std::uint32_t resume)
+    {
+        auto &execution = *static_cast<BFExecution *>(self);
+        if (execution.m_input.pending())
+        {
+            execution.m_suspension = Suspension{0, 0, resume, std::nullopt, true};
+            return -1;
+        }
+
+        auto value = static_cast<Cell>(current);
+        execution.read_byte(value);
+        return value;
+    }
+
+    static void *jit_scan(void *self, void *ptr, std::int32_t stride)
+    {
+        return static_cast<BFExecution *>(self)->m_scanner.find_zero(static_cast<Cell *>(ptr), stride);
+    }
+
+    [[noreturn]] static void jit_fault(void *, std::uint32_t where)
+    {
+        BFTape::fault(static_cast<BFTapeFault>(where));
+    }
+
+    // preempt() for native code, which leaves the budget to it when it
+    // suspends
+    static std::int64_t jit_preempt(void *self, std::int64_t left, std::uint32_t weight, std::uint32_t loop,
+                                    std::uint32_t resume)
+    {
+        auto &execution = *static_cast<BFExecution *>(self);
+        if (execution.preempt(left, weight))
+            return left;
+
+        execution.m_left = left;
+        execution.m_suspension = Suspension{loop, weight, resume};
+        return -1;
+    }
+#else
+    template <bool CHECKED, bool STATS, bool LIMITED>
+    void run_jit()
+    {
+        run_threaded<false, CHECKED, STATS, LIMITED>();
+    }
+#endif
+};
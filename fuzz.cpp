@@ -0,0 +1,971 @@
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "emit.hpp"
+#include "execution.hpp"
+#include "ir.hpp"
+#include "parser.hpp"
+#include "program.hpp"
+#include "stream.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BF_HAS_AOT_CHECK 1
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#else
+#define BF_HAS_AOT_CHECK 0
+#endif
+
+// Differential testing of the engines: random programs run on every
+// engine, optimization level and execution mode must leave the output,
+// tape and pointer of a plain reference interpreter of the unoptimized
+// source. Larger generated programs are timed on every engine and level,
+// and a level slower than the one below it, or than the last run of the
+// history file, fails the run as a wrong result does.
+
+#ifndef BF_C_COMPILER
+#define BF_C_COMPILER "cc"
+#endif
+
+// the same small generator as bf-bench, so a seed is a corpus everywhere
+class BFFuzzRandom
+{
+private:
+    std::uint64_t m_state;
+
+public:
+    explicit BFFuzzRandom(std::uint64_t seed) noexcept
+        : m_state{seed}
+    {
+    }
+
+    [[nodiscard]] std::uint32_t next(std::uint32_t bound) noexcept
+    {
+        m_state = m_state * 6364136223846793005u + 1442695040888963407u;
+        return static_cast<std::uint32_t>((m_state >> 33) % bound);
+    }
+};
+
+struct BFFuzzCase
+{
+    std::string name;
+    std::string source;
+    std::string input;
+    BFEofMode eof = BFEofMode::UNCHANGED;
+    int cell_bits = 8;
+    std::size_t tape_size = BFTape::DEFAULT_SIZE;
+    bool faults = false; // touches a cell off the tape, so every run must stop with an error
+};
+
+// what a run leaves, for cells of Cell
+template <typename Cell>
+struct BFFuzzOutcome
+{
+    std::string output;
+    std::optional<BFError> error;
+    std::vector<Cell> cells;
+    std::size_t pointer = 0;
+    BFStats stats;
+    std::uint64_t instructions = 0; // BF commands the reference executed
+};
+
+// how the engines run a case, each with its own code
+enum class BFFuzzMode
+{
+    PLAIN,
+    CHECKED, // with bounds checks
+    STATS,   // with counters and no checks, whose ops, iterations and tape extent must agree between engines
+    SLICED,  // fed input a few bytes at a time, with budgets of a few ops
+    STREAMED // fed the source in pieces through run_pieces(), as --stream runs it
+};
+
+struct BFFuzzReport
+{
+    std::size_t cases = 0;
+    std::size_t discarded = 0; // generated programs that left the tape or ran too long
+    std::size_t runs = 0;
+    std::size_t failures = 0;
+};
+
+inline constexpr std::pair<const char *, BFEngine> BF_FUZZ_ENGINES[] = {
+    {"switch", BFEngine::SWITCH}, {"threaded", BFEngine::THREADED}, {"jit", BFEngine::JIT}, {"tiered", BFEngine::TIERED}};
+
+inline constexpr const char *BF_FUZZ_MODES[] = {"plain", "checked", "stats", "sliced", "streamed"};
+
+// BF commands a checked case may run on the reference
+constexpr std::uint64_t FUZZ_STEPS = 1'000'000;
+
+// and a timed one, at least and at most, so timings are neither noise nor slow
+constexpr std::uint64_t TIMED_STEPS_MIN = 30'000'000;
+constexpr std::uint64_t TIMED_STEPS_MAX = 150'000'000;
+
+// a timing shorter than this is too noisy to fail a run over
+constexpr double TIMING_FLOOR = 0.001;
+
+// cells reached from where a case starts by loops that move
+[[nodiscard]] static std::string fuzz_pattern(BFFuzzRandom &random)
+{
+    switch (random.next(8))
+    {
+    case 0:
+        return random.next(2) ? "[-]" : "[+]";
+
+    case 1:
+        return std::string{"["} + std::string(1 + random.next(3), random.next(2) ? '>' : '<') + "]";
+
+    case 2:
+    {
+        // a multiplication into up to three cells on one side
+        const char out = random.next(2) ? '>' : '<', back = out == '>' ? '<' : '>';
+        std::string loop = random.next(2) ? "[-" : "[";
+        std::uint32_t moved = 0;
+        for (std::uint32_t targets = 1 + random.next(3); targets > 0; --targets)
+        {
+            const std::uint32_t step = 1 + random.next(3);
+            loop.append(step, out);
+            loop.append(1 + random.next(4), random.next(3) ? '+' : '-');
+            moved += step;
+        }
+        loop.append(moved, back);
+        return loop + (loop[1] == '-' ? "]" : "-]");
+    }
+
+    case 3:
+    {
+        // a run of adds wide enough for ADD_VEC
+        const std::uint32_t cells = 8 + random.next(10);
+        std::string run;
+        for (std::uint32_t i = 0; i < cells; ++i)
+            run += std::string(1 + random.next(3), random.next(4) ? '+' : '-') + '>';
+        return run + std::string(cells, '<');
+    }
+
+    default:
+        return std::string(1 + random.next(20), random.next(2) ? '+' : '-');
+    }
+}
+
+[[nodiscard]] static std::string fuzz_block(BFFuzzRandom &random, std::uint32_t depth)
+{
+    std::string block;
+    for (std::uint32_t items = 1 + random.next(10); items > 0; --items)
+    {
+        switch (random.next(depth < 3 ? 7 : 6))
+        {
+        case 0:
+            block.append(1 + random.next(30), random.next(2) ? '+' : '-');
+            break;
+
+        case 1:
+            block.append(1 + random.next(6), random.next(2) ? '>' : '<');
+            break;
+
+        case 2:
+            block += random.next(3) ? '.' : ',';
+            break;
+
+        case 3:
+        case 4:
+            block += fuzz_pattern(random);
+            break;
+
+        case 5:
+            block += random.next(2) ? "." : "";
+            break;
+
+        default:
+            // mostly counted down at the end, so most loops end
+            block += "[" + fuzz_block(random, depth + 1) + (random.next(4) ? "-]" : "]");
+            break;
+        }
+    }
+    return block;
+}
+
+[[nodiscard]] static BFFuzzCase random_case(BFFuzzRandom &random, std::size_t index)
+{
+    // 4096 cells are whole pages at any width, so the guards border both ends
+    constexpr std::size_t TAPE_SIZES[] = {64, 300, 1000, 4096, 30'000};
+    constexpr int CELL_BITS[] = {8, 8, 16, 32};
+    constexpr BFEofMode EOF_MODES[] = {BFEofMode::UNCHANGED, BFEofMode::ZERO, BFEofMode::MINUS_ONE};
+
+    BFFuzzCase fuzz_case;
+    fuzz_case.name = "case-" + std::to_string(index);
+    fuzz_case.tape_size = TAPE_SIZES[random.next(5)];
+    fuzz_case.cell_bits = CELL_BITS[random.next(4)];
+    fuzz_case.eof = EOF_MODES[random.next(3)];
+
+    // mostly from the middle, now and then from the first or last cell, so
+    // optimized code must touch no cell past the end that the program skips
+    const std::uint32_t start = random.next(4);
+    const std::size_t cell = start == 0 ? 0 : start == 1 ? fuzz_case.tape_size - 1 : fuzz_case.tape_size / 2;
+    fuzz_case.source = std::string(cell, '>') + fuzz_block(random, 0);
+
+    fuzz_case.input.resize(random.next(24));
+    for (char &c : fuzz_case.input)
+        c = static_cast<char>(random.next(256));
+    return fuzz_case;
+}
+
+// Programs that once went wrong, checked before the generated ones. Most
+// start at the first or last cell of a tape of whole 4 KiB pages, so the
+// guard regions lie right past the cells they reach.
+[[nodiscard]] static std::vector<BFFuzzCase> regression_cases()
+{
+    constexpr std::size_t PAGE_TAPE = 4096;
+
+    return {
+        // multiply loops that never run touch nothing on either side
+        BFFuzzCase{.name = "regression-multiply-first", .source = "[-<+>]+.", .tape_size = PAGE_TAPE},
+        BFFuzzCase{.name = "regression-multiply-last",
+                   .source = std::string(PAGE_TAPE - 1, '>') + "[->+<]+.",
+                   .tape_size = PAGE_TAPE},
+        // a move far past the guard region, split into pieces when streamed
+        BFFuzzCase{.name = "regression-stream-long-move",
+                   .source = std::string(std::size_t{BFOp::MAX_REACH} * 40, '>') + "+.",
+                   .faults = true},
+    };
+}
+
+// Nested counted loops around a body of cell ops, patterns included,
+// that comes back where it started. No I/O, so what is timed is the
+// engine.
+[[nodiscard]] static BFFuzzCase timed_case(BFFuzzRandom &random, std::size_t index)
+{
+    std::string body = ">";
+    std::uint32_t ptr = 0;
+    for (std::uint32_t items = 4 + random.next(12); items > 0; --items)
+    {
+        const std::uint32_t target = random.next(8);
+        body.append(target > ptr ? target - ptr : ptr - target, target > ptr ? '>' : '<');
+        ptr = target;
+
+        const std::uint32_t kind = random.next(6);
+        if (kind == 0)
+            body += "[-]";
+        else if (kind == 1)
+        {
+            body += "[->" + std::string(1 + random.next(5), '+') + ">" + std::string(1 + random.next(5), '-') + "<<]";
+        }
+        else if (kind == 2)
+        {
+            for (std::uint32_t i = 0; i < 9; ++i)
+                body += std::string(1 + random.next(3), '+') + '>';
+            body.append(9, '<');
+        }
+        else
+            body.append(1 + random.next(20), random.next(2) ? '+' : '-');
+    }
+    body.append(ptr, '<');
+    body += '<';
+
+    std::string source;
+    for (std::uint32_t level = 0; level < 3; ++level)
+        source += std::string(40 + random.next(60), '+') + "[>";
+    source += body;
+    source += "<-]<-]<-]";
+
+    return BFFuzzCase{.name = "timed-" + std::to_string(index), .source = std::move(source)};
+}
+
+// The unoptimized program on a plain tape. nullopt when it moves off the
+// tape or runs more than steps commands, which the engines needn't agree
+// on: they only fault where a cell off the tape is used.
+template <typename Cell>
+[[nodiscard]] static std::optional<BFFuzzOutcome<Cell>> run_reference(const BFFuzzCase &fuzz_case,
+                                                                     std::uint64_t steps)
+{
+    const auto parsed = BFParser::parse(fuzz_case.source);
+    if (!parsed)
+        return std::nullopt;
+
+    const std::vector<BFOp> &ops = parsed->ops;
+    BFFuzzOutcome<Cell> outcome;
+    outcome.cells.resize(fuzz_case.tape_size);
+    std::size_t input = 0;
+    std::uint64_t &count = outcome.instructions;
+
+    for (std::size_t i = 0;; ++i)
+    {
+        if (count > steps)
+            return std::nullopt;
+
+        const BFOp &op = ops[i];
+        Cell &cell = outcome.cells[outcome.pointer];
+        switch (op.code)
+        {
+        case BFOpCode::ADD:
+            cell = static_cast<Cell>(cell + static_cast<Cell>(op.arg));
+            count += static_cast<std::uint64_t>(op.arg < 0 ? -static_cast<std::int64_t>(op.arg) : op.arg);
+            break;
+
+        case BFOpCode::MOVE:
+        {
+            const auto target = static_cast<std::int64_t>(outcome.pointer) + op.arg;
+            if (target < 0 || target >= static_cast<std::int64_t>(outcome.cells.size()))
+                return std::nullopt;
+            outcome.pointer = static_cast<std::size_t>(target);
+            count += static_cast<std::uint64_t>(op.arg < 0 ? -static_cast<std::int64_t>(op.arg) : op.arg);
+            break;
+        }
+
+        case BFOpCode::OUT:
+            outcome.output += static_cast<char>(static_cast<unsigned char>(cell));
+            ++count;
+            break;
+
+        case BFOpCode::IN:
+            if (input < fuzz_case.input.size())
+                cell = static_cast<Cell>(static_cast<unsigned char>(fuzz_case.input[input++]));
+            else if (fuzz_case.eof == BFEofMode::ZERO)
+                cell = 0;
+            else if (fuzz_case.eof == BFEofMode::MINUS_ONE)
+                cell = static_cast<Cell>(-1);
+            ++count;
+            break;
+
+        case BFOpCode::LOOP_BEGIN:
+            if (cell == 0)
+                i = op.jump;
+            ++count;
+            break;
+
+        case BFOpCode::LOOP_END:
+            if (cell)
+                i = op.jump;
+            ++count;
+            break;
+
+        case BFOpCode::END:
+            return outcome;
+
+        default:
+            ++count;
+            break;
+        }
+    }
+}
+
+// the source in pieces of up to a few bytes or up to a chunk of the loader
+template <typename Cell>
+[[nodiscard]] static std::expected<void, BFError> run_pieces(BFExecution<Cell> &execution,
+                                                             const BFFuzzCase &fuzz_case,
+                                                             const BFOptimizeOptions &optimize, BFFuzzRandom &random)
+{
+    const auto read = [&](auto &&feed)
+    {
+        for (std::string_view source = fuzz_case.source; !source.empty();)
+        {
+            const std::size_t size = std::min<std::size_t>(
+                1 + random.next(random.next(2) ? 8 : static_cast<std::uint32_t>(BFSourceLoader::CHUNK_SIZE)),
+                source.size());
+            feed(source.substr(0, size));
+            source.remove_prefix(size);
+        }
+        return true;
+    };
+
+    return run_pieces(execution, optimize, read, fuzz_case.name);
+}
+
+// optimize is what a streamed run compiles each piece with
+template <typename Cell>
+[[nodiscard]] static BFFuzzOutcome<Cell> run_engine(const BFCompiledProgram::Pointer &program,
+                                                    const BFOptimizeOptions &optimize, const BFFuzzCase &fuzz_case,
+                                                    BFEngine engine, BFFuzzMode mode, std::uint64_t limit,
+                                                    BFFuzzRandom &random)
+{
+    BFRunOptions options{.engine = engine, .eof = fuzz_case.eof, .tape_size = fuzz_case.tape_size};
+    options.check_bounds = options.check_bounds || mode == BFFuzzMode::CHECKED;
+    options.stats = mode == BFFuzzMode::STATS;
+    options.fed_input = mode == BFFuzzMode::SLICED;
+    options.limits.steps = limit;
+
+    BFFuzzOutcome<Cell> outcome;
+    std::istringstream in{fuzz_case.input};
+    std::ostringstream out;
+    const auto execution = mode == BFFuzzMode::STREAMED ? create_streamed<Cell>(options, in, out)
+                                                        : BFExecution<Cell>::create(program, options, in, out);
+    if (!execution)
+    {
+        outcome.error = execution.error();
+        return outcome;
+    }
+
+    if (mode == BFFuzzMode::STREAMED)
+        if (const auto ran = run_pieces(**execution, fuzz_case, optimize, random); !ran)
+            outcome.error = ran.error();
+
+    for (std::size_t fed = 0; mode != BFFuzzMode::STREAMED;)
+    {
+        BFBudget budget;
+        if (mode == BFFuzzMode::SLICED)
+            budget.steps = 1 + random.next(64);
+
+        const auto state = (*execution)->run(budget);
+        if (!state)
+            outcome.error = state.error();
+        if (!state || *state == BFRunState::FINISHED)
+            break;
+        if (*state != BFRunState::INPUT)
+            continue;
+
+        const std::size_t bytes = std::min<std::size_t>(1 + random.next(4), fuzz_case.input.size() - fed);
+        if (bytes == 0)
+            (*execution)->close_input();
+        else
+        {
+            std::copy_n(fuzz_case.input.data() + fed, bytes, (*execution)->input_space().data());
+            (*execution)->commit_input(bytes);
+            fed += bytes;
+        }
+    }
+
+    outcome.output = std::move(out).str();
+    const std::span<const Cell> cells = (*execution)->cells();
+    outcome.cells.assign(cells.begin(), cells.end());
+    outcome.pointer = (*execution)->pointer();
+    outcome.stats = (*execution)->stats();
+    return outcome;
+}
+
+// what differs from the reference, empty for nothing
+template <typename Cell>
+[[nodiscard]] static std::string compare(const BFFuzzOutcome<Cell> &expected, const BFFuzzOutcome<Cell> &outcome)
+{
+    if (outcome.error)
+        return "failed: " + outcome.error->message;
+    if (outcome.output != expected.output)
+        return "output differs";
+    if (outcome.pointer != expected.pointer)
+        return "pointer at " + std::to_string(outcome.pointer) + " instead of " + std::to_string(expected.pointer);
+
+    // tapes are rounded up to whole pages, where the reference never goes
+    const std::size_t size = expected.cells.size();
+    if (!std::equal(expected.cells.begin(), expected.cells.end(), outcome.cells.begin()) ||
+        std::any_of(outcome.cells.begin() + static_cast<std::ptrdiff_t>(size), outcome.cells.end(),
+                    [](Cell cell) { return cell != 0; }))
+        return "tape differs";
+
+    return {};
+}
+
+[[nodiscard]] static std::string json_string(std::string_view text)
+{
+    std::string out = "\"";
+    for (const char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+
+        if (static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x7F)
+        {
+            constexpr char HEX[] = "0123456789abcdef";
+            const auto byte = static_cast<unsigned char>(c);
+            out += "\\u00";
+            out += HEX[byte >> 4];
+            out += HEX[byte & 0xF];
+        }
+        else
+            out += c;
+    }
+    return out + '"';
+}
+
+// a failure on stderr, with what reproduces it the first time for a case
+static void report_failure(BFFuzzReport &report, const BFFuzzCase &fuzz_case, std::string_view where,
+                           std::string_view what, bool &reported_case)
+{
+    ++report.failures;
+    std::cerr << fuzz_case.name << ' ' << where << ": " << what << '\n';
+    if (!reported_case)
+        std::cerr << "  --cell-bits=" << fuzz_case.cell_bits << " --tape-size=" << fuzz_case.tape_size << " --eof="
+                  << (fuzz_case.eof == BFEofMode::ZERO ? "0" : fuzz_case.eof == BFEofMode::MINUS_ONE ? "-1" : "unchanged")
+                  << "\n  source: " << json_string(fuzz_case.source) << "\n  input: " << json_string(fuzz_case.input)
+                  << '\n';
+    reported_case = true;
+}
+
+[[nodiscard]] static std::string where(std::string_view engine, int level, bool precompute, BFFuzzMode mode)
+{
+    return std::string{engine} + " -O" + std::to_string(level) + (precompute ? " --precompute " : " ") +
+           BF_FUZZ_MODES[static_cast<std::size_t>(mode)];
+}
+
+#if BF_HAS_AOT_CHECK
+// runs argv with stdin and stdout from and to files, the exit status
+[[nodiscard]] static int run_process(const std::vector<std::string> &args, const std::string &input,
+                                     const std::string &output)
+{
+    std::vector<char *> argv;
+    for (const std::string &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        const int in = open(input.empty() ? "/dev/null" : input.c_str(), O_RDONLY);
+        const int out = open(output.empty() ? "/dev/null" : output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    if (pid < 0)
+        return -1;
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// The case translated by --emit=c, and --emit=asm on x86-64, built with
+// the C compiler and run; what differs from the reference, empty for
+// nothing. Only the output can be compared.
+template <typename Cell>
+[[nodiscard]] static std::string check_aot(const BFCompiledProgram &program, const BFFuzzCase &fuzz_case,
+                                           const BFFuzzOutcome<Cell> &expected, const std::string &compiler,
+                                           const std::filesystem::path &directory)
+{
+    const std::string input = (directory / "input").string();
+    std::ofstream{input, std::ofstream::binary} << fuzz_case.input;
+
+    std::vector<std::string> languages{"c"};
+#if defined(__x86_64__)
+    languages.emplace_back("s");
+#endif
+
+    for (const std::string &language : languages)
+    {
+        const std::string source = (directory / ("program." + language)).string();
+        const std::string binary = (directory / "program").string();
+        const std::string output = (directory / "output").string();
+        {
+            std::ofstream file{source};
+            if (language == "c")
+                emit_c<Cell>(file, program.code(), fuzz_case.tape_size, fuzz_case.eof, nullptr);
+            else
+                emit_asm<Cell>(file, program.code(), fuzz_case.tape_size, fuzz_case.eof, nullptr);
+        }
+
+        if (run_process({compiler, "-O1", "-w", "-o", binary, source}, "", "") != 0)
+            return "--emit=" + std::string{language == "c" ? "c" : "asm"} + " didn't build with " + compiler;
+
+        const int status = run_process({binary}, input, output);
+        std::ifstream file{output, std::ifstream::binary};
+        const std::string written{std::istreambuf_iterator<char>{file}, {}};
+        if (status != 0)
+            return "--emit=" + std::string{language == "c" ? "c" : "asm"} + " exited with " + std::to_string(status);
+        if (written != expected.output)
+            return "--emit=" + std::string{language == "c" ? "c" : "asm"} + " output differs";
+    }
+
+    return {};
+}
+#endif
+
+struct BFFuzzOptions
+{
+    std::size_t cases = 300;
+    std::uint64_t seed = 1;
+    std::size_t timed = 4;
+    std::size_t repeat = 3;
+    double tolerance = 0.2; // how much slower a timing may get
+    std::string history;    // empty for none
+    std::string compiler;   // of the AOT check, empty for none
+};
+
+// Every engine, level and mode on one case against the reference. Where
+// the reference stays on the tape, every run must finish without an
+// error as well, whichever cells it starts next to. A case that faults
+// has no reference, every run must stop with an error instead.
+template <typename Cell>
+static void check_case(const BFFuzzOptions &options, const BFFuzzCase &fuzz_case, BFFuzzRandom &random,
+                       BFFuzzReport &report)
+{
+    const auto expected = fuzz_case.faults ? std::nullopt : run_reference<Cell>(fuzz_case, FUZZ_STEPS);
+    if (!expected && !fuzz_case.faults)
+    {
+        ++report.discarded;
+        return;
+    }
+
+    ++report.cases;
+    bool reported = false;
+
+    // more than any engine counts for what the reference ran, so a run that
+    // reaches it loops where it shouldn't
+    const std::uint64_t limit = expected ? 2 * expected->instructions + 1000 : 0;
+
+    for (const bool precompute : {false, true})
+    {
+        for (int level = 0; level <= BFOptimizeOptions::MAX_LEVEL; ++level)
+        {
+            BFOptimizeOptions optimize = BFOptimizeOptions::from_level(level);
+            optimize.prefix_steps = precompute ? BFOptimizeOptions::DEFAULT_PREFIX_STEPS : 0;
+
+            const auto program = BFCompiledProgram::from_source(fuzz_case.source, optimize);
+            if (!program)
+            {
+                report_failure(report, fuzz_case, where("compile", level, precompute, BFFuzzMode::PLAIN),
+                               program.error().message, reported);
+                continue;
+            }
+
+            for (std::size_t m = 0; m < std::size(BF_FUZZ_MODES); ++m)
+            {
+                const auto mode = static_cast<BFFuzzMode>(m);
+                std::optional<BFStats> counted; // by the first engine, in STATS mode
+                // streamed pieces never evaluate a prefix
+                if (mode == BFFuzzMode::STREAMED && precompute)
+                    continue;
+
+                for (const auto &[name, engine] : BF_FUZZ_ENGINES)
+                {
+                    ++report.runs;
+                    const BFFuzzOutcome<Cell> outcome = run_engine<Cell>(
+                        *program, optimize, fuzz_case, engine, mode, mode == BFFuzzMode::SLICED ? limit : 0, random);
+
+                    std::string difference;
+                    if (!expected)
+                        difference = outcome.error ? "" : "ran on past the end of the tape";
+                    else
+                        difference = compare(*expected, outcome);
+
+                    if (difference.empty() && expected && mode == BFFuzzMode::STATS)
+                    {
+                        if (!counted)
+                            counted = outcome.stats;
+                        else if (outcome.stats.ops != counted->ops ||
+                                 outcome.stats.loop_iterations != counted->loop_iterations)
+                            difference = "counts " + std::to_string(outcome.stats.ops) + " ops and " +
+                                         std::to_string(outcome.stats.loop_iterations) + " iterations, switch " +
+                                         std::to_string(counted->ops) + " and " +
+                                         std::to_string(counted->loop_iterations);
+                        else if (outcome.stats.tape_low != counted->tape_low ||
+                                 outcome.stats.tape_high != counted->tape_high)
+                            difference = "reaches cells " + std::to_string(outcome.stats.tape_low) + " to " +
+                                         std::to_string(outcome.stats.tape_high) + ", switch " +
+                                         std::to_string(counted->tape_low) + " to " +
+                                         std::to_string(counted->tape_high);
+                    }
+
+                    if (!difference.empty())
+                        report_failure(report, fuzz_case, where(name, level, precompute, mode), difference, reported);
+                }
+            }
+        }
+    }
+
+#if BF_HAS_AOT_CHECK
+    if (!options.compiler.empty() && expected)
+    {
+        // one level per case, in turn, with and without the prefix
+        const auto index = static_cast<std::size_t>(report.cases - 1);
+        const int level = static_cast<int>(index % (BFOptimizeOptions::MAX_LEVEL + 1));
+        const bool precompute = index / (BFOptimizeOptions::MAX_LEVEL + 1) % 2;
+
+        BFOptimizeOptions optimize = BFOptimizeOptions::from_level(level);
+        optimize.prefix_steps = precompute ? BFOptimizeOptions::DEFAULT_PREFIX_STEPS : 0;
+        if (const auto program = BFCompiledProgram::from_source(fuzz_case.source, optimize))
+        {
+            const std::filesystem::path directory =
+                std::filesystem::temp_directory_path() / ("bf-fuzz-" + std::to_string(getpid()));
+            std::filesystem::create_directories(directory);
+
+            ++report.runs;
+            if (const std::string difference = check_aot(**program, fuzz_case, *expected, options.compiler, directory);
+                !difference.empty())
+                report_failure(report, fuzz_case, where("aot", level, precompute, BFFuzzMode::PLAIN), difference,
+                               reported);
+        }
+    }
+#else
+    static_cast<void>(options);
+#endif
+}
+
+struct BFFuzzTiming
+{
+    std::string program;
+    std::string engine;
+    int level = 0;
+    std::uint64_t instructions = 0;
+    double seconds = 0; // the fastest of the repeats
+};
+
+// The case on every engine and level, each the fastest of repeat runs of
+// one execution, checked against the reference as well. A level slower
+// than the level below on the same engine fails. False for a case whose
+// reference run is too short or too long to time.
+[[nodiscard]] static bool time_case(const BFFuzzOptions &options, const BFFuzzCase &fuzz_case, BFFuzzReport &report,
+                      std::vector<BFFuzzTiming> &timings)
+{
+    const auto expected = run_reference<std::uint8_t>(fuzz_case, TIMED_STEPS_MAX);
+    if (!expected || expected->instructions < TIMED_STEPS_MIN)
+    {
+        ++report.discarded;
+        return false;
+    }
+
+    bool reported = false;
+    for (const auto &[name, engine] : BF_FUZZ_ENGINES)
+    {
+        for (int level = 0; level <= BFOptimizeOptions::MAX_LEVEL; ++level)
+        {
+            const auto program = BFCompiledProgram::from_source(fuzz_case.source, BFOptimizeOptions::from_level(level));
+            if (!program)
+            {
+                report_failure(report, fuzz_case, where(name, level, false, BFFuzzMode::PLAIN),
+                               program.error().message, reported);
+                continue;
+            }
+
+            std::istringstream in;
+            std::ostringstream out;
+            const auto execution = BFExecution<>::create(
+                *program, BFRunOptions{.engine = engine, .tape_size = fuzz_case.tape_size}, in, out);
+            if (!execution)
+            {
+                report_failure(report, fuzz_case, where(name, level, false, BFFuzzMode::PLAIN),
+                               execution.error().message, reported);
+                continue;
+            }
+
+            BFFuzzTiming &timing = timings.emplace_back(fuzz_case.name, name, level, expected->instructions);
+            for (std::size_t r = 0; r < options.repeat; ++r)
+            {
+                (*execution)->reset();
+                const auto start = std::chrono::steady_clock::now();
+                const auto ran = (*execution)->run();
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (r == 0 || seconds < timing.seconds)
+                    timing.seconds = seconds;
+
+                BFFuzzOutcome<std::uint8_t> outcome;
+                if (!ran)
+                    outcome.error = ran.error();
+                outcome.output = out.str();
+                outcome.cells.assign((*execution)->cells().begin(), (*execution)->cells().end());
+                outcome.pointer = (*execution)->pointer();
+                if (const std::string difference = compare(*expected, outcome); !difference.empty())
+                {
+                    report_failure(report, fuzz_case, where(name, level, false, BFFuzzMode::PLAIN), difference,
+                                   reported);
+                    break;
+                }
+            }
+
+            if (level == 0 || timings.size() < 2)
+                continue;
+
+            const BFFuzzTiming &below = timings[timings.size() - 2];
+            if (below.program == timing.program && below.engine == timing.engine && below.level == level - 1 &&
+                timing.seconds >= TIMING_FLOOR && timing.seconds > below.seconds * (1 + options.tolerance))
+                report_failure(report, fuzz_case, where(name, level, false, BFFuzzMode::PLAIN),
+                               "slower than -O" + std::to_string(level - 1) + ", " +
+                                   std::to_string(timing.seconds * 1000) + " ms against " +
+                                   std::to_string(below.seconds * 1000) + " ms",
+                               reported);
+        }
+    }
+
+    return true;
+}
+
+// The history is one line per timing, "<unix time> <seed> <program>
+// <engine> <level> <instructions per second>". Every timing is checked
+// against the last one of the same seed, program, engine and level, and
+// a run without failures appends its own, so a slowdown keeps failing
+// until it's fixed.
+[[nodiscard]] static bool check_history(const BFFuzzOptions &options, const std::vector<BFFuzzTiming> &timings,
+                                        BFFuzzReport &report)
+{
+    using Key = std::tuple<std::uint64_t, std::string, std::string, int>;
+    std::map<Key, double> last;
+    {
+        std::ifstream file{options.history};
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields{line};
+            long long time = 0;
+            Key key;
+            double speed = 0;
+            if (fields >> time >> std::get<0>(key) >> std::get<1>(key) >> std::get<2>(key) >> std::get<3>(key) >> speed)
+                last[key] = speed;
+        }
+    }
+
+    for (const BFFuzzTiming &timing : timings)
+    {
+        const auto it = last.find(Key{options.seed, timing.program, timing.engine, timing.level});
+        const double speed = static_cast<double>(timing.instructions) / timing.seconds;
+        if (it == last.end() || timing.seconds < TIMING_FLOOR || speed * (1 + options.tolerance) >= it->second)
+            continue;
+
+        ++report.failures;
+        std::cerr << timing.program << ' ' << timing.engine << " -O" << timing.level << ": " << speed
+                  << " instructions/s, the history has " << it->second << '\n';
+    }
+
+    if (report.failures)
+        return true;
+
+    std::ofstream file{options.history, std::ofstream::app};
+    const auto now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    for (const BFFuzzTiming &timing : timings)
+        file << now.count() << ' ' << options.seed << ' ' << timing.program << ' ' << timing.engine << ' '
+             << timing.level << ' ' << static_cast<double>(timing.instructions) / timing.seconds << '\n';
+
+    file.close();
+    if (!file)
+    {
+        std::cerr << "Could not write " << options.history << ".\n";
+        return false;
+    }
+    return true;
+}
+
+[[nodiscard]] static bool parse_number(std::string_view text, std::uint64_t &value)
+{
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc{} && end == text.data() + text.size();
+}
+
+int main(int argc, char **argv)
+{
+    const char *USAGE = R"==(Usage
+
+    bf-fuzz [options]
+
+Checks known regressions, then generates random programs and inputs,
+and runs each on every engine and optimization level, with and without
+--precompute, plain, with bounds checks, with stats, in budgeted slices
+with fed input and streamed in pieces, and compares output, tape and
+pointer with a reference interpreter. Programs start in the middle of
+the tape or at either end. Then times larger
+generated programs on every engine and level. Prints the results as
+JSON and exits with 1 when a run was wrong or a level was slower than
+the one below it.
+
+Options
+
+    --cases=<n>  random programs to check (default 300)
+    --seed=<n>   of the generated programs (default 1)
+    --timed=<n>  larger programs to time (default 4)
+    --repeat=<n> runs per timing, the fastest counts (default 3)
+    --tolerance=<percent>
+                 how much slower a timing may be than the level below,
+                 or than the history (default 20)
+    --history=<path>
+                 also fail when a timing is slower than the last one in
+                 this file, and append the timings when nothing failed
+    --aot[=<compiler>]
+                 also build every case with --emit=c, and --emit=asm on
+                 x86-64, using a C compiler, and compare the output
+    )==";
+
+    BFFuzzOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg{argv[i]};
+        std::uint64_t value = 0;
+        if (arg.starts_with("--cases=") && parse_number(arg.substr(8), value))
+            options.cases = value;
+        else if (arg.starts_with("--seed=") && parse_number(arg.substr(7), value))
+            options.seed = value;
+        else if (arg.starts_with("--timed=") && parse_number(arg.substr(8), value))
+            options.timed = value;
+        else if (arg.starts_with("--repeat=") && parse_number(arg.substr(9), value) && value > 0)
+            options.repeat = value;
+        else if (arg.starts_with("--tolerance=") && parse_number(arg.substr(12), value))
+            options.tolerance = static_cast<double>(value) / 100;
+        else if (arg.starts_with("--history=") && arg.size() > 10)
+            options.history = arg.substr(10);
+        else if (arg == "--aot")
+            options.compiler = BF_C_COMPILER;
+        else if (arg.starts_with("--aot=") && arg.size() > 6)
+            options.compiler = arg.substr(6);
+        else
+        {
+            std::cerr << USAGE;
+            return 1;
+        }
+    }
+
+#if !BF_HAS_AOT_CHECK
+    if (!options.compiler.empty())
+    {
+        std::cerr << "--aot needs a POSIX system to run the compiler.\n";
+        return 1;
+    }
+#endif
+
+    BFFuzzReport report;
+    BFFuzzRandom random{options.seed};
+    for (const BFFuzzCase &regression : regression_cases())
+        check_case<std::uint8_t>(options, regression, random, report);
+
+    for (std::size_t generated = 0, regressions = report.cases; report.cases < regressions + options.cases; ++generated)
+    {
+        const BFFuzzCase generated_case = random_case(random, generated);
+        if (generated_case.cell_bits == 16)
+            check_case<std::uint16_t>(options, generated_case, random, report);
+        else if (generated_case.cell_bits == 32)
+            check_case<std::uint32_t>(options, generated_case, random, report);
+        else
+            check_case<std::uint8_t>(options, generated_case, random, report);
+    }
+
+#if BF_HAS_AOT_CHECK
+    if (!options.compiler.empty())
+        std::filesystem::remove_all(std::filesystem::temp_directory_path() / ("bf-fuzz-" + std::to_string(getpid())));
+#endif
+
+    // the timed programs come from a generator of their own, so --cases
+    // doesn't change them
+    std::vector<BFFuzzTiming> timings;
+    BFFuzzRandom timed_random{options.seed};
+    for (std::size_t timed = 0, generated = 0; timed < options.timed; ++generated)
+        timed += time_case(options, timed_case(timed_random, generated), report, timings);
+
+    const bool recorded = options.history.empty() || check_history(options, timings, report);
+
+    std::cout << "{\n  \"seed\": " << options.seed << ",\n  \"cases\": " << report.cases
+              << ",\n  \"discarded\": " << report.discarded << ",\n  \"runs\": " << report.runs
+              << ",\n  \"failures\": " << report.failures << ",\n  \"timings\": [";
+    for (std::size_t i = 0; i < timings.size(); ++i)
+    {
+        const BFFuzzTiming &timing = timings[i];
+        std::cout << (i ? ",\n" : "\n") << "    {\"program\": " << json_string(timing.program)
+                  << ", \"engine\": " << json_string(timing.engine) << ", \"level\": " << timing.level
+                  << ", \"instructions\": " << timing.instructions << ", \"instructions_per_second\": "
+                  << static_cast<double>(timing.instructions) / timing.seconds
+                  << ", \"wall_seconds\": " << timing.seconds << '}';
+    }
+    std::cout << "\n  ]\n}\n";
+
+    return report.failures == 0 && recorded ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <span>
+
+// what , stores once the input is exhausted
+enum class BFEofMode
+{
+    UNCHANGED, // leave the cell as it is
+    ZERO,      // store 0
+    MINUS_ONE  // store -1, all bits set
+};
+
+// Serves , from large raw reads of the stream. Input is read unformatted,
+// so whitespace is passed through like any other byte. A refill blocks
+// only until some input is available, never for a whole block, so
+// interactive use still works. Refills are counted and timed for --stats,
+// which costs a clock read per refill.
+//
+// Without a stream the buffer is fed instead: the owner reads into
+// space() and commit()s what it got, or close()s it at end of input, and
+// never blocks in get(). Callers look at pending() first, see
+// BFRunState::INPUT.
+class BFInputBuffer
+{
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 64 * 1024;
+
+private:
+    std::istream *m_stream; // null for a fed buffer
+    std::unique_ptr<char[]> m_buffer;
+    std::size_t m_capacity;
+    std::size_t m_pos = 0;
+    std::size_t m_end = 0;
+    bool m_closed = false; // a fed buffer gets no more input
+
+    std::uint64_t m_read = 0; // bytes taken into the buffer and not dropped
+    std::chrono::steady_clock::duration m_waited{};
+
+public:
+    explicit BFInputBuffer(std::istream *stream, std::size_t capacity = DEFAULT_CAPACITY)
+        : m_stream{stream},
+          m_buffer{std::make_unique_for_overwrite<char[]>(capacity ? capacity : 1)},
+          m_capacity{capacity ? capacity : 1}
+    {
+    }
+
+    BFInputBuffer(const BFInputBuffer &) = delete;
+    BFInputBuffer &operator=(const BFInputBuffer &) = delete;
+
+    // drops whatever is buffered, and opens a fed buffer again
+    void reset() noexcept
+    {
+        m_read -= m_end - m_pos;
+        m_pos = m_end = 0;
+        m_closed = false;
+    }
+
+    // null to feed it from now on
+    void reset(std::istream *stream) noexcept
+    {
+        reset();
+        m_stream = stream;
+    }
+
+    [[nodiscard]] bool fed() const noexcept
+    {
+        return m_stream == nullptr;
+    }
+
+    // true when a fed buffer is empty but not closed, so , has to wait
+    [[nodiscard]] bool pending() const noexcept
+    {
+        return !m_stream && m_pos == m_end && !m_closed;
+    }
+
+    // where a fed buffer takes more input, empty when it is full; moves
+    // what is buffered to the front first
+    [[nodiscard]] std::span<char> space() noexcept
+    {
+        if (m_pos == m_end)
+            m_pos = m_end = 0;
+        else if (m_pos != 0 && m_end == m_capacity)
+        {
+            std::copy(m_buffer.get() + m_pos, m_buffer.get() + m_end, m_buffer.get());
+            m_end -= m_pos;
+            m_pos = 0;
+        }
+
+        return {m_buffer.get() + m_end, m_capacity - m_end};
+    }
+
+    // bytes written to the front of space()
+    void commit(std::size_t bytes) noexcept
+    {
+        m_end += bytes;
+        m_read += bytes;
+    }
+
+    // end of input for a fed buffer, once what is buffered is taken
+    void close() noexcept
+    {
+        m_closed = true;
+    }
+
+    // false when the next get() may have to wait for the stream
+    [[nodiscard]] bool buffered() const noexcept
+    {
+        return m_pos != m_end;
+    }
+
+    // bytes handed out by get() so far
+    [[nodiscard]] std::uint64_t consumed() const noexcept
+    {
+        return m_read - (m_end - m_pos);
+    }
+
+    // time spent waiting for the stream so far
+    [[nodiscard]] std::chrono::steady_clock::duration waited() const noexcept
+    {
+        return m_waited;
+    }
+
+    // the next byte, or -1 at end of input
+    [[nodiscard]] int get()
+    {
+        if (m_pos == m_end && !fill())
+            return -1;
+
+        return static_cast<unsigned char>(m_buffer[m_pos++]);
+    }
+
+private:
+    bool fill()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const bool filled = read();
+        m_waited += std::chrono::steady_clock::now() - start;
+        if (filled)
+            m_read += m_end;
+        return filled;
+    }
+
+    bool read()
+    {
+        using Traits = std::istream::traits_type;
+
+        // a fed buffer runs dry only once it is closed
+        if (!m_stream)
+            return false;
+
+        std::streambuf *buffer = m_stream->rdbuf();
+        if (!buffer)
+            return false;
+
+        // block for one byte, then take whatever else is already there
+        const Traits::int_type first = buffer->sbumpc();
+        if (Traits::eq_int_type(first, Traits::eof()))
+            return false;
+
+        m_buffer[0] = Traits::to_char_type(first);
+        m_pos = 0;
+        m_end = 1;
+
+        const std::streamsize available = buffer->in_avail();
+        if (available > 0)
+        {
+            const auto wanted = std::min(static_cast<std::size_t>(available), m_capacity - 1);
+            m_end += static_cast<std::size_t>(buffer->sgetn(m_buffer.get() + 1, static_cast<std::streamsize>(wanted)));
+        }
+
+        return true;
+    }
+};
+
+// Collects output bytes and hands them to the stream in large unformatted
+// writes, instead of one formatted insertion per byte. A capacity of 0
+// writes and flushes every byte, for terminals. Writes are counted and
+// timed like the refills of BFInputBuffer.
+class BFOutputBuffer
+{
+public:
+    static constexpr std::size_t DEFAULT_CAPACITY = 64 * 1024;
+
+private:
+    std::ostream *m_stream;
+    std::unique_ptr<char[]> m_buffer;
+    std::size_t m_capacity;
+    std::size_t m_size = 0;
+
+    std::uint64_t m_written = 0;
+    std::chrono::steady_clock::duration m_waited{};
+
+public:
+    explicit BFOutputBuffer(std::ostream &stream, std::size_t capacity = DEFAULT_CAPACITY)
+        : m_stream{&stream},
+          m_buffer{std::make_unique_for_overwrite<char[]>(capacity ? capacity : 1)},
+          m_capacity{capacity ? capacity : 1}
+    {
+    }
+
+    BFOutputBuffer(const BFOutputBuffer &) = delete;
+    BFOutputBuffer &operator=(const BFOutputBuffer &) = delete;
+
+    // flushes what is pending to the old stream first
+    void reset(std::ostream &stream)
+    {
+        flush();
+        m_stream = &stream;
+    }
+
+    ~BFOutputBuffer()
+    {
+        flush();
+    }
+
+    void put(unsigned char byte)
+    {
+        m_buffer[m_size++] = static_cast<char>(byte);
+        if (m_size == m_capacity)
+            flush();
+    }
+
+    void flush()
+    {
+        if (m_size == 0)
+            return;
+
+        const auto start = std::chrono::steady_clock::now();
+        m_stream->write(m_buffer.get(), static_cast<std::streamsize>(m_size));
+        m_stream->flush();
+        m_waited += std::chrono::steady_clock::now() - start;
+
+        m_written += m_size;
+        m_size = 0;
+    }
+
+    // bytes put so far, written or pending
+    [[nodiscard]] std::uint64_t written() const noexcept
+    {
+        return m_written + m_size;
+    }
+
+    // time spent writing to the stream so far
+    [[nodiscard]] std::chrono::steady_clock::duration waited() const noexcept
+    {
+        return m_waited;
+    }
+};
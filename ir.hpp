@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ops that touch a cell address it as ptr[offset]
+enum class BFOpCode : std::uint8_t
+{
+    ADD,        // ptr[offset] += arg
+    MOVE,       // ptr += arg
+    OUT,        // . of ptr[offset]
+    IN,         // , into ptr[offset]
+    LOOP_BEGIN, // [ jump is the index of the matching LOOP_END
+    LOOP_END,   // ] jump is the index of the matching LOOP_BEGIN
+    SET,        // ptr[offset] = arg
+    SCAN,       // while (*ptr) ptr += arg
+    MUL_ADD,    // ptr[offset] += ptr[src] * arg, where ptr[src] isn't 0
+    ADD_VEC,    // ptr[offset + i] += deltas[src + i] for i < arg
+    END         // end of program
+};
+
+struct BFSourceLoc
+{
+    std::uint32_t line = 1;
+    std::uint32_t column = 1;
+};
+
+struct BFOp
+{
+    // How far one op may move the pointer or address a cell from it. No
+    // two MOVEs follow each other, a probe (ADD [ptr], 0) goes between
+    // them, so two cell accesses are at most 3 * MAX_REACH cells apart and
+    // one off the tape always lands in its guard region, see BFTape.
+    static constexpr std::int32_t MAX_REACH = 1 << 16;
+
+    BFOpCode code = BFOpCode::END;
+    std::int32_t arg = 0;
+    std::int32_t offset = 0;
+    std::int32_t src = 0;
+    std::uint32_t jump = 0;
+    BFSourceLoc loc{};
+};
+
+// The state the start of a program left before it first read input, see
+// evaluate_prefix(). A run begins from it instead of the zeroed tape: the
+// cells set, the pointer moved and the output written.
+struct BFPrefix
+{
+    static constexpr std::int64_t MAX_CELLS = 1 << 20; // how far the evaluated start may reach
+
+    std::int64_t pointer = 0;        // the cell the pointer is on
+    std::int64_t reach = 0;          // one past the highest cell touched, the tape must be this large
+    std::int64_t first = 0;          // the cell of cells[0], every cell outside cells is 0
+    std::vector<std::int32_t> cells; // truncated to the cell width, like the ADD_VEC deltas
+    std::string output;
+};
+
+struct BFPrefixView
+{
+    std::int64_t pointer = 0;
+    std::int64_t reach = 0;
+    std::int64_t first = 0;
+    std::span<const std::int32_t> cells;
+    std::string_view output;
+
+    BFPrefixView() = default;
+
+    BFPrefixView(std::int64_t pointer, std::int64_t reach, std::int64_t first, std::span<const std::int32_t> cells,
+                 std::string_view output) noexcept
+        : pointer{pointer}, reach{reach}, first{first}, cells{cells}, output{output}
+    {
+    }
+
+    BFPrefixView(const BFPrefix &prefix) noexcept
+        : pointer{prefix.pointer}, reach{prefix.reach}, first{prefix.first}, cells{prefix.cells}, output{prefix.output}
+    {
+    }
+};
+
+// a parsed program, always terminated by a single END op
+struct BFProgram
+{
+    std::vector<BFOp> ops;
+    std::vector<std::int32_t> deltas; // the operands of ADD_VEC
+    std::optional<BFPrefix> prefix;   // where the ops start from, the zeroed tape when empty
+};
+
+// a program without its storage, over a BFProgram or a mapped bytecode file
+struct BFProgramView
+{
+    std::span<const BFOp> ops;
+    std::span<const std::int32_t> deltas;
+    std::optional<BFPrefixView> prefix;
+
+    BFProgramView() = default;
+
+    BFProgramView(std::span<const BFOp> ops, std::span<const std::int32_t> deltas,
+                  std::optional<BFPrefixView> prefix = std::nullopt) noexcept
+        : ops{ops}, deltas{deltas}, prefix{prefix}
+    {
+    }
+
+    BFProgramView(const BFProgram &program) noexcept
+        : ops{program.ops}, deltas{program.deltas}
+    {
+        if (program.prefix)
+            prefix = *program.prefix;
+    }
+};
+
+[[nodiscard]] constexpr const char *to_string(BFOpCode code) noexcept
+{
+    switch (code)
+    {
+    case BFOpCode::ADD:
+        return "ADD";
+
+    case BFOpCode::MOVE:
+        return "MOVE";
+
+    case BFOpCode::OUT:
+        return "OUT";
+
+    case BFOpCode::IN:
+        return "IN";
+
+    case BFOpCode::LOOP_BEGIN:
+        return "LOOP_BEGIN";
+
+    case BFOpCode::LOOP_END:
+        return "LOOP_END";
+
+    case BFOpCode::SET:
+        return "SET";
+
+    case BFOpCode::SCAN:
+        return "SCAN";
+
+    case BFOpCode::MUL_ADD:
+        return "MUL_ADD";
+
+    case BFOpCode::ADD_VEC:
+        return "ADD_VEC";
+
+    case BFOpCode::END:
+        return "END";
+    }
+
+    return "?";
+}
+
+// recomputes the jump of every LOOP_BEGIN/LOOP_END, for passes that
+// add or remove ops
+inline void link_loops(BFProgram &program, std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+{
+    std::pmr::vector<std::uint32_t> open_loops{scratch};
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        BFOp &op = program.ops[i];
+        if (op.code == BFOpCode::LOOP_BEGIN)
+            open_loops.push_back(static_cast<std::uint32_t>(i));
+        else if (op.code == BFOpCode::LOOP_END)
+        {
+            op.jump = open_loops.back();
+            program.ops[open_loops.back()].jump = static_cast<std::uint32_t>(i);
+            open_loops.pop_back();
+        }
+    }
+}
+
+[[nodiscard]] constexpr bool is_within_reach(std::int64_t cells) noexcept
+{
+    return cells >= -BFOp::MAX_REACH && cells <= BFOp::MAX_REACH;
+}
+
+// whether the op moves and addresses cells within BFOp::MAX_REACH
+[[nodiscard]] inline bool is_within_reach(const BFOp &op) noexcept
+{
+    switch (op.code)
+    {
+    case BFOpCode::MOVE:
+    case BFOpCode::SCAN:
+        return is_within_reach(op.arg);
+
+    case BFOpCode::ADD:
+    case BFOpCode::SET:
+    case BFOpCode::OUT:
+    case BFOpCode::IN:
+        return is_within_reach(op.offset);
+
+    case BFOpCode::MUL_ADD:
+        return is_within_reach(op.offset) && is_within_reach(op.src);
+
+    case BFOpCode::ADD_VEC:
+        return is_within_reach(op.offset) && is_within_reach(static_cast<std::int64_t>(op.offset) + op.arg);
+
+    default:
+        return true;
+    }
+}
+
+// Whether ops read from outside, a cache entry or bytecode file, are safe
+// to run: a single END last, every loop linked both ways to its bracket,
+// every move and cell within BFOp::MAX_REACH and no two MOVEs in a row,
+// every ADD_VEC within the deltas and the prefix within its limits.
+[[nodiscard]] inline bool is_well_formed(BFProgramView program) noexcept
+{
+    const std::size_t size = program.ops.size();
+    if (size == 0)
+        return false;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        const BFOp &op = program.ops[i];
+        if (op.code > BFOpCode::END || (op.code == BFOpCode::END) != (i + 1 == size))
+            return false;
+
+        if (op.code == BFOpCode::LOOP_BEGIN &&
+            (op.jump <= i || op.jump >= size || program.ops[op.jump].code != BFOpCode::LOOP_END ||
+             program.ops[op.jump].jump != i))
+            return false;
+
+        if (op.code == BFOpCode::LOOP_END && (op.jump >= i || program.ops[op.jump].code != BFOpCode::LOOP_BEGIN))
+            return false;
+
+        if (!is_within_reach(op) || (op.code == BFOpCode::MOVE && i > 0 && program.ops[i - 1].code == BFOpCode::MOVE))
+            return false;
+
+        if (op.code == BFOpCode::ADD_VEC &&
+            (op.arg < 0 || op.src < 0 ||
+             static_cast<std::size_t>(op.src) + static_cast<std::size_t>(op.arg) > program.deltas.size()))
+            return false;
+    }
+
+    if (const auto &prefix = program.prefix)
+    {
+        const auto cells = static_cast<std::int64_t>(prefix->cells.size());
+        if (prefix->pointer < -BFPrefix::MAX_CELLS || prefix->pointer > BFPrefix::MAX_CELLS || prefix->first < 0 ||
+            prefix->first > BFPrefix::MAX_CELLS || cells > BFPrefix::MAX_CELLS || prefix->first + cells > prefix->reach ||
+            prefix->reach > BFPrefix::MAX_CELLS)
+            return false;
+    }
+
+    return true;
+}
+
+struct BFCellRef
+{
+    std::int32_t offset;
+};
+
+inline std::ostream &operator<<(std::ostream &out, BFCellRef cell)
+{
+    out << "[ptr";
+    if (cell.offset > 0)
+        out << '+' << cell.offset;
+    else if (cell.offset < 0)
+        out << cell.offset;
+    return out << ']';
+}
+
+// the op's name and operands, as in dump()
+inline void dump_op(std::ostream &out, BFProgramView program, const BFOp &op)
+{
+    out << to_string(op.code);
+
+    switch (op.code)
+    {
+    case BFOpCode::ADD:
+    case BFOpCode::SET:
+        out << ' ' << BFCellRef{op.offset} << ", " << op.arg;
+        break;
+
+    case BFOpCode::OUT:
+    case BFOpCode::IN:
+        out << ' ' << BFCellRef{op.offset};
+        break;
+
+    case BFOpCode::MOVE:
+    case BFOpCode::SCAN:
+        out << ' ' << op.arg;
+        break;
+
+    case BFOpCode::MUL_ADD:
+        out << ' ' << BFCellRef{op.offset} << ", " << BFCellRef{op.src} << ", " << op.arg;
+        break;
+
+    case BFOpCode::ADD_VEC:
+        out << ' ' << BFCellRef{op.offset} << ", {";
+        for (std::int32_t k = 0; k < op.arg; ++k)
+            out << (k ? ", " : "") << program.deltas[static_cast<std::size_t>(op.src + k)];
+        out << '}';
+        break;
+
+    case BFOpCode::LOOP_BEGIN:
+    case BFOpCode::LOOP_END:
+        out << " -> " << op.jump;
+        break;
+
+    default:
+        break;
+    }
+}
+
+inline void dump(std::ostream &out, BFProgramView program)
+{
+    if (const auto &prefix = program.prefix)
+        out << "prefix\tpointer " << prefix->pointer << ", " << prefix->cells.size() << " cells from "
+            << prefix->first << ", reach " << prefix->reach << ", " << prefix->output.size() << " output bytes\n";
+
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        const BFOp &op = program.ops[i];
+        out << i << '\t' << op.loc.line << ':' << op.loc.column << '\t';
+        dump_op(out, program, op);
+        out << '\n';
+    }
+}
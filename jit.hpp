@@ -0,0 +1,786 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bounds.hpp"
+#include "ir.hpp"
+#include "stats.hpp"
+#include "tape.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define BF_HAS_JIT 1
+#include <sys/mman.h>
+#else
+#define BF_HAS_JIT 0
+#endif
+
+// how jitted code reaches back into the interpreter for . and , for
+// scans that don't stop at the first cell, in code with bounds checks
+// for failed checks and, in preemptible code, when its step budget runs
+// out
+struct BFJitCallbacks
+{
+    void *context;
+    void (*out)(void *context, std::uint32_t value);
+
+    // The cell , stores, zero-extended. Preemptible code passes the code
+    // offset of the , as resume and returns at once on a negative result,
+    // to run the , again from there later.
+    std::int64_t (*in)(void *context, std::uint32_t current, std::uint32_t resume);
+    void *(*scan)(void *context, void *ptr, std::int32_t stride);
+    void (*fault)(void *context, std::uint32_t where); // a BFTapeFault, never returns
+    const void *tape_begin;                            // the first cell
+    const void *tape_end;                              // one past the last cell
+    BFCounters *counters;                              // what code with counters counts into
+
+    // Called at a back-edge once *budget went below zero, with the budget
+    // after charging the iteration its weight, the LOOP_BEGIN of the loop
+    // and the code offset of the body. Returns the new budget to go on, or
+    // a negative one to return at once, in which case *budget is left
+    // alone.
+    std::int64_t (*preempt)(void *context, std::int64_t budget, std::uint32_t weight, std::uint32_t loop,
+                            std::uint32_t resume);
+    std::int64_t *budget; // steps preemptible code may run, read on entry and written back at the end
+    std::uint32_t resume; // a body offset from preempt to continue at, 0 to start at the top
+};
+
+// what jitted code does besides running the program
+enum class BFJitMode
+{
+    PLAIN,
+    CHECKED,      // the bounds checks of analyze_bounds()
+    STATS,        // the counters of --stats, the tape extent where the checks would be
+    CHECKED_STATS // both
+};
+
+#if BF_HAS_JIT
+
+// A program compiled to x86-64 machine code (System V ABI) for tapes of
+// Cell. The tape pointer lives in rbx, the callbacks in r12, in code with
+// counters the counters in r13 and in preemptible code the step budget in
+// r14 for the whole run. Owns the executable mapping.
+template <typename Cell>
+class BFJitCode
+{
+public:
+    using Entry = Cell *(*)(Cell *ptr, const BFJitCallbacks *callbacks);
+
+private:
+    void *m_memory = nullptr;
+    std::size_t m_size = 0;
+
+    BFJitCode(void *memory, std::size_t size) noexcept
+        : m_memory{memory}, m_size{size}
+    {
+    }
+
+public:
+    BFJitCode(BFJitCode &&other) noexcept
+        : m_memory{std::exchange(other.m_memory, nullptr)},
+          m_size{std::exchange(other.m_size, 0)}
+    {
+    }
+
+    BFJitCode &operator=(BFJitCode &&other) noexcept
+    {
+        std::swap(m_memory, other.m_memory);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    BFJitCode(const BFJitCode &) = delete;
+    BFJitCode &operator=(const BFJitCode &) = delete;
+
+    ~BFJitCode()
+    {
+        if (m_memory)
+            munmap(m_memory, m_size);
+    }
+
+    // nullopt when no executable memory could be mapped, or an offset
+    // doesn't fit a 32-bit displacement; checks the tape pointer where
+    // bounds says to when given and checked is set, and counts by weights
+    // when those are given too (see BFCounters), the tape extent where
+    // bounds says. Code made with charges charges every loop iteration to
+    // the budget of BFJitCallbacks and can stop at a back-edge and continue
+    // there later. The code is assembled in scratch memory, see BFArena.
+    [[nodiscard]] static std::optional<BFJitCode> compile(
+        BFProgramView program, const BFBounds *bounds = nullptr, const BFWeights *weights = nullptr,
+        const BFWeights *charges = nullptr, bool checked = true,
+        std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+    {
+        std::pmr::vector<std::uint8_t> code{scratch};
+        if (!Assembler{bounds, weights, charges, checked, scratch}.assemble(program, code))
+            return std::nullopt;
+
+        return load(code);
+    }
+
+    // Only the loop whose LOOP_BEGIN is at begin, for the tiered engine. The
+    // code runs the whole loop, testing the cell at LOOP_BEGIN first, and
+    // returns the tape pointer it ended on after the LOOP_END. The checks
+    // after the loop are left to the caller, and so is counting the
+    // LOOP_BEGIN. The loop indices preempt gets are relative to begin.
+    [[nodiscard]] static std::optional<BFJitCode> compile_loop(
+        BFProgramView program, std::size_t begin, BFJitMode mode = BFJitMode::PLAIN, bool preemptible = false,
+        std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+    {
+        const auto first = program.ops.begin() + static_cast<std::ptrdiff_t>(begin);
+        std::pmr::vector<BFOp> loop{first, first + program.ops[begin].jump - static_cast<std::ptrdiff_t>(begin) + 1,
+                                    scratch};
+
+        const auto base = static_cast<std::uint32_t>(begin);
+        for (BFOp &op : loop)
+            if (op.code == BFOpCode::LOOP_BEGIN || op.code == BFOpCode::LOOP_END)
+                op.jump -= base;
+        loop.push_back(BFOp{});
+
+        const BFProgramView view{loop, program.deltas};
+        const bool stats = mode == BFJitMode::STATS || mode == BFJitMode::CHECKED_STATS;
+        const std::optional<BFBounds> bounds =
+            mode != BFJitMode::PLAIN ? std::optional{analyze_bounds(view, scratch)} : std::nullopt;
+        const std::optional<BFWeights> weights =
+            stats || preemptible ? std::optional{analyze_weights(view, scratch)} : std::nullopt;
+
+        return compile(view, bounds ? &*bounds : nullptr, stats ? &*weights : nullptr,
+                       preemptible ? &*weights : nullptr, mode != BFJitMode::STATS, scratch);
+    }
+
+    // The machine code of a program, without mapping it. The code only
+    // addresses itself rip-relative, so it runs wherever it is loaded.
+    [[nodiscard]] static std::optional<std::vector<std::uint8_t>> assemble(
+        BFProgramView program, const BFBounds *bounds = nullptr, const BFWeights *weights = nullptr,
+        const BFWeights *charges = nullptr, bool checked = true,
+        std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+    {
+        std::pmr::vector<std::uint8_t> code{scratch};
+        if (!Assembler{bounds, weights, charges, checked, scratch}.assemble(program, code))
+            return std::nullopt;
+
+        return std::vector<std::uint8_t>(code.begin(), code.end());
+    }
+
+    // maps code from assemble() executable
+    [[nodiscard]] static std::optional<BFJitCode> load(std::span<const std::uint8_t> code)
+    {
+        void *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return std::nullopt;
+
+        std::memcpy(memory, code.data(), code.size());
+        if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(memory, code.size());
+            return std::nullopt;
+        }
+
+        return BFJitCode{memory, code.size()};
+    }
+
+    // returns the tape pointer the program ended on
+    Cell *run(Cell *ptr, const BFJitCallbacks &callbacks) const
+    {
+        return std::bit_cast<Entry>(m_memory)(ptr, &callbacks);
+    }
+
+private:
+    class Assembler
+    {
+    private:
+        static constexpr std::int64_t WIDTH = sizeof(Cell);
+
+        // register numbers as used in ModRM
+        static constexpr std::uint8_t EAX = 0, ESI = 6;
+
+        // ModRM reg field selecting the operation for 80/81/83
+        static constexpr std::uint8_t OP_ADD = 0, OP_CMP = 7;
+
+        static constexpr std::uint8_t JMP = 0xE9, JB = 0x82, JE = 0x84, JNE = 0x85, JA = 0x87, JNS = 0x89,
+                                      JGE = 0x8D;
+
+        // paddb/paddw/paddd for one cell lane
+        static constexpr std::uint8_t PADD = WIDTH == 1 ? 0xFC : WIDTH == 2 ? 0xFD : 0xFE;
+
+        // all of it in the scratch memory of compile()
+        std::pmr::vector<std::uint8_t> m_code;
+        bool m_in_range = true;
+
+        // null for code without bounds checks or counters; the rel32 fields
+        // of the jumps of failed checks, patched to a call of the fault
+        // callback each, none where the code only counts
+        const BFBounds *m_bounds;
+        bool m_checked;
+        std::pmr::vector<std::size_t> m_below;
+        std::pmr::vector<std::size_t> m_above;
+
+        const BFWeights *m_weights; // null for code without counters, which needs m_bounds
+        const BFWeights *m_charges; // null for code that can't be preempted
+
+        // ADD_VEC deltas, placed after the code and addressed rip-relative;
+        // every fixup is a rel32 position and the offset it refers to
+        std::pmr::vector<std::uint8_t> m_constants;
+        std::pmr::vector<std::pair<std::size_t, std::size_t>> m_fixups;
+
+    public:
+        Assembler(const BFBounds *bounds, const BFWeights *weights, const BFWeights *charges, bool checked,
+                  std::pmr::memory_resource *scratch) noexcept
+            : m_code{scratch},
+              m_bounds{bounds},
+              m_checked{checked},
+              m_below{scratch},
+              m_above{scratch},
+              m_weights{bounds ? weights : nullptr},
+              m_charges{charges},
+              m_constants{scratch},
+              m_fixups{scratch}
+        {
+        }
+
+        // code takes the memory of m_code, so it must use the same scratch
+        [[nodiscard]] bool assemble(BFProgramView program, std::pmr::vector<std::uint8_t> &code)
+        {
+            // the rel32 field of every LOOP_BEGIN's je, patched at its LOOP_END,
+            // and where its body starts
+            std::pmr::vector<std::size_t> pending(program.ops.size(), m_code.get_allocator());
+            std::pmr::vector<std::size_t> bodies(program.ops.size(), m_code.get_allocator());
+
+            // push rbx; push r12; push r13 (keeps rsp 16-byte aligned for calls),
+            // push r14; push r15 as well in preemptible code
+            bytes({0x53, 0x41, 0x54, 0x41, 0x55});
+            if (m_charges)
+                bytes({0x41, 0x56, 0x41, 0x57});
+            // mov rbx, rdi; mov r12, rsi
+            bytes({0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4});
+            // mov r13, [r12+56]
+            if (m_weights)
+                bytes({0x4D, 0x8B, 0x6C, 0x24, 0x38});
+            if (m_charges)
+                resume_entry();
+
+            if (m_bounds)
+                check(m_bounds->start);
+
+            for (std::size_t i = 0; i < program.ops.size(); ++i)
+            {
+                const BFOp &op = program.ops[i];
+
+                switch (op.code)
+                {
+                case BFOpCode::ADD:
+                    // add [rbx+offset], arg
+                    alu_imm(OP_ADD, op.offset, op.arg);
+                    break;
+
+                case BFOpCode::SET:
+                    // mov [rbx+offset], arg
+                    mov_imm(op.offset, op.arg);
+                    break;
+
+                case BFOpCode::MOVE:
+                    add_rbx(op.arg);
+                    break;
+
+                // the target may be off the tape where the loop never ran
+                case BFOpCode::MUL_ADD:
+                {
+                    // movzx eax, [rbx+src]; test eax, eax; je done; imul eax, eax, arg;
+                    // add [rbx+offset], eax; done:
+                    load(EAX, op.src);
+                    bytes({0x85, 0xC0});
+                    const std::size_t to_done = jump(JE);
+                    if (m_bounds && !m_bounds->checks[i].empty())
+                    {
+                        check(m_bounds->checks[i]);
+                        load(EAX, op.src);
+                    }
+                    bytes({0x69, 0xC0});
+                    imm(op.arg, 4);
+                    width_prefix();
+                    bytes({WIDTH == 1 ? std::uint8_t{0x00} : std::uint8_t{0x01}});
+                    cell(EAX, op.offset);
+                    patch_to(to_done, m_code.size());
+                    break;
+                }
+
+                case BFOpCode::ADD_VEC:
+                    add_vector(op, program.deltas);
+                    break;
+
+                case BFOpCode::OUT:
+                    load_call_args(op.offset);
+                    // call [r12+8]
+                    bytes({0x41, 0xFF, 0x54, 0x24, 0x08});
+                    if (m_bounds)
+                        check(m_bounds->checks[i]);
+                    break;
+
+                case BFOpCode::IN:
+                {
+                    const std::size_t start = m_code.size();
+                    load_call_args(op.offset);
+                    // mov edx, start in preemptible code
+                    if (m_charges)
+                    {
+                        bytes({0xBA});
+                        imm(static_cast<std::int64_t>(start), 4);
+                    }
+                    // call [r12+16]; mov [rbx+offset], eax
+                    bytes({0x41, 0xFF, 0x54, 0x24, 0x10});
+                    if (m_charges)
+                        wait_for_input();
+                    width_prefix();
+                    bytes({WIDTH == 1 ? std::uint8_t{0x88} : std::uint8_t{0x89}});
+                    cell(EAX, op.offset);
+                    if (m_bounds)
+                        check(m_bounds->checks[i]);
+                    break;
+                }
+
+                // a check on entry runs before the start of the body, one per
+                // iteration after it
+                case BFOpCode::LOOP_BEGIN:
+                    test_cell();
+                    pending[i] = jump(JE);
+                    if (m_charges)
+                        charge(m_charges->loops[i]);
+                    if (m_bounds && !m_bounds->checks[i].every_iteration)
+                        check(m_bounds->checks[i]);
+                    bodies[i] = m_code.size();
+                    if (m_weights)
+                        count_iteration(m_weights->loops[i]);
+                    if (m_bounds && m_bounds->checks[i].every_iteration)
+                        check(m_bounds->checks[i]);
+                    break;
+
+                case BFOpCode::LOOP_END:
+                    // jne to the start of the body, then the je of LOOP_BEGIN lands here
+                    test_cell();
+                    if (m_charges)
+                        back_edge(op.jump, bodies[op.jump]);
+                    else
+                        patch_to(jump(JNE), bodies[op.jump]);
+                    patch_to(pending[op.jump], m_code.size());
+                    if (m_bounds)
+                        check(m_bounds->checks[i]);
+                    break;
+
+                case BFOpCode::SCAN:
+                {
+                    // cmp [rbx], 0; je done; mov rdi, [r12]; mov rsi, rbx; mov edx, arg;
+                    // call [r12+24]; mov rbx, rax; done:
+                    test_cell();
+                    const std::size_t to_done = jump(JE);
+                    bytes({0x49, 0x8B, 0x3C, 0x24, 0x48, 0x89, 0xDE, 0xBA});
+                    imm(op.arg, 4);
+                    bytes({0x41, 0xFF, 0x54, 0x24, 0x18, 0x48, 0x89, 0xC3});
+                    patch_to(to_done, m_code.size());
+                    if (m_bounds)
+                        check(m_bounds->checks[i]);
+                    break;
+                }
+
+                case BFOpCode::END:
+                    // mov rax, [r12+72]; mov [rax], r14
+                    if (m_charges)
+                        bytes({0x49, 0x8B, 0x44, 0x24, 0x48, 0x4C, 0x89, 0x30});
+                    epilogue();
+                    break;
+                }
+            }
+
+            fault_call(m_below, BFTapeFault::BELOW);
+            fault_call(m_above, BFTapeFault::ABOVE);
+
+            const std::size_t constants = m_code.size();
+            m_code.insert(m_code.end(), m_constants.begin(), m_constants.end());
+            for (const auto &[rel32_at, offset] : m_fixups)
+                patch_to(rel32_at, constants + offset);
+
+            code = std::move(m_code);
+            return m_in_range;
+        }
+
+    private:
+        void bytes(std::initializer_list<std::uint8_t> list)
+        {
+            m_code.insert(m_code.end(), list);
+        }
+
+        // little-endian immediate of `size` bytes
+        void imm(std::int64_t value, std::int64_t size)
+        {
+            const auto bits = static_cast<std::uint64_t>(value);
+            for (std::int64_t i = 0; i < size; ++i)
+                m_code.push_back(static_cast<std::uint8_t>(bits >> (8 * i)));
+        }
+
+        [[nodiscard]] static bool fits_int8(std::int64_t value) noexcept
+        {
+            return value >= -128 && value <= 127;
+        }
+
+        // cells are scaled to byte displacements, which must fit in 32 bits
+        [[nodiscard]] std::int64_t scaled(std::int32_t cells) noexcept
+        {
+            const std::int64_t disp = cells * WIDTH;
+            if (disp < std::numeric_limits<std::int32_t>::min() || disp > std::numeric_limits<std::int32_t>::max())
+                m_in_range = false;
+            return disp;
+        }
+
+        // the operand-size prefix for 16-bit cells
+        void width_prefix()
+        {
+            if (WIDTH == 2)
+                bytes({0x66});
+        }
+
+        // arg reduced to the cell width and sign-extended back, so it can
+        // be checked against the short imm8 forms
+        [[nodiscard]] static std::int64_t cell_immediate(std::int32_t arg) noexcept
+        {
+            return static_cast<std::make_signed_t<Cell>>(static_cast<Cell>(arg));
+        }
+
+        // ModRM (plus displacement) addressing [rbx+offset cells]
+        void cell(std::uint8_t reg, std::int32_t offset)
+        {
+            constexpr std::uint8_t RBX = 3;
+            const std::int64_t disp = scaled(offset);
+
+            if (disp == 0)
+                bytes({static_cast<std::uint8_t>(reg << 3 | RBX)});
+            else if (fits_int8(disp))
+                bytes({static_cast<std::uint8_t>(0x40 | reg << 3 | RBX), static_cast<std::uint8_t>(disp)});
+            else
+            {
+                bytes({static_cast<std::uint8_t>(0x80 | reg << 3 | RBX)});
+                imm(disp, 4);
+            }
+        }
+
+        // add/cmp [rbx+offset], value
+        void alu_imm(std::uint8_t operation, std::int32_t offset, std::int32_t value)
+        {
+            const std::int64_t immediate = cell_immediate(value);
+
+            width_prefix();
+            if (WIDTH == 1)
+            {
+                bytes({0x80});
+                cell(operation, offset);
+                imm(immediate, 1);
+            }
+            else if (fits_int8(immediate))
+            {
+                bytes({0x83});
+                cell(operation, offset);
+                imm(immediate, 1);
+            }
+            else
+            {
+                bytes({0x81});
+                cell(operation, offset);
+                imm(immediate, WIDTH);
+            }
+        }
+
+        // mov [rbx+offset], value
+        void mov_imm(std::int32_t offset, std::int32_t value)
+        {
+            width_prefix();
+            bytes({WIDTH == 1 ? std::uint8_t{0xC6} : std::uint8_t{0xC7}});
+            cell(0, offset);
+            imm(cell_immediate(value), WIDTH);
+        }
+
+        // zero-extending load of [rbx+offset] into a 32-bit register
+        void load(std::uint8_t reg, std::int32_t offset)
+        {
+            if (WIDTH == 1)
+                bytes({0x0F, 0xB6});
+            else if (WIDTH == 2)
+                bytes({0x0F, 0xB7});
+            else
+                bytes({0x8B});
+            cell(reg, offset);
+        }
+
+        void add_rbx(std::int32_t value)
+        {
+            const std::int64_t disp = scaled(value);
+            if (fits_int8(disp))
+            {
+                bytes({0x48, 0x83, 0xC3});
+                imm(disp, 1);
+            }
+            else
+            {
+                bytes({0x48, 0x81, 0xC3});
+                imm(disp, 4);
+            }
+        }
+
+        // cmp [rbx], 0
+        void test_cell()
+        {
+            alu_imm(OP_CMP, 0, 0);
+        }
+
+        // lea rax, [rbx+low]; cmp rax, [r12+40]; jb below;
+        // lea rax, [rbx+high+1]; cmp rax, [r12+48]; ja above
+        // where checked, the extent after it in code with counters
+        void check(const BFRangeCheck &range)
+        {
+            if (range.empty())
+                return;
+
+            if (m_checked)
+            {
+                lea_rax(range.low * WIDTH);
+                bytes({0x49, 0x3B, 0x44, 0x24, 0x28});
+                m_below.push_back(jump(JB));
+                lea_rax((range.high + 1) * WIDTH);
+                bytes({0x49, 0x3B, 0x44, 0x24, 0x30});
+                m_above.push_back(jump(JA));
+            }
+            else
+                lea_rax((range.high + 1) * WIDTH);
+
+            if (m_weights)
+                extend(range);
+        }
+
+        // cmp rax, [r13+24]; jbe 1f; mov [r13+24], rax; 1:
+        // lea rax, [rbx+low]; cmp rax, [r13+16]; jae 2f; mov [r13+16], rax; 2:
+        // with rax one past the range, as check() leaves it
+        void extend(const BFRangeCheck &range)
+        {
+            bytes({0x49, 0x3B, 0x45, 0x18, 0x76, 0x04, 0x49, 0x89, 0x45, 0x18});
+            lea_rax(range.low * WIDTH);
+            bytes({0x49, 0x3B, 0x45, 0x10, 0x73, 0x04, 0x49, 0x89, 0x45, 0x10});
+        }
+
+        // mov rax, rbx; pop r15; pop r14 in preemptible code; pop r13; pop r12;
+        // pop rbx; ret
+        void epilogue()
+        {
+            bytes({0x48, 0x89, 0xD8});
+            if (m_charges)
+                bytes({0x41, 0x5F, 0x41, 0x5E});
+            bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+        }
+
+        // mov rax, [r12+72]; mov r14, [rax]; mov eax, [r12+80]; test eax, eax;
+        // je start; lea rcx, [rip+code]; add rax, rcx; jmp rax; start:
+        void resume_entry()
+        {
+            bytes({0x49, 0x8B, 0x44, 0x24, 0x48, 0x4C, 0x8B, 0x30, 0x41, 0x8B, 0x44, 0x24, 0x50, 0x85, 0xC0});
+            const std::size_t to_start = jump(JE);
+            bytes({0x48, 0x8D, 0x0D});
+            imm(-static_cast<std::int64_t>(m_code.size() + 4), 4);
+            bytes({0x48, 0x01, 0xC8, 0xFF, 0xE0});
+            patch_to(to_start, m_code.size());
+        }
+
+        // sub r14, weight
+        void charge(std::uint32_t weight)
+        {
+            if (weight > std::numeric_limits<std::int32_t>::max())
+                m_in_range = false;
+            if (fits_int8(weight))
+            {
+                bytes({0x49, 0x83, 0xEE});
+                imm(weight, 1);
+            }
+            else
+            {
+                bytes({0x49, 0x81, 0xEE});
+                imm(weight, 4);
+            }
+        }
+
+        // The taken back-edge of preemptible code, after the test of the
+        // cell: je out; sub r14, weight; jge body; then, with the budget
+        // spent, mov rdi, [r12]; mov rsi, r14; mov edx, weight; mov ecx, loop;
+        // mov r8d, body; call [r12+64]; mov r14, rax; test rax, rax; jns body;
+        // and return as at the END, leaving the budget to preempt. out:
+        void back_edge(std::size_t loop, std::size_t body)
+        {
+            const std::uint32_t weight = m_charges->loops[loop];
+            const std::size_t to_out = jump(JE);
+            charge(weight);
+            patch_to(jump(JGE), body);
+
+            bytes({0x49, 0x8B, 0x3C, 0x24, 0x4C, 0x89, 0xF6, 0xBA});
+            imm(weight, 4);
+            bytes({0xB9});
+            imm(static_cast<std::int64_t>(loop), 4);
+            bytes({0x41, 0xB8});
+            imm(static_cast<std::int64_t>(body), 4);
+            bytes({0x41, 0xFF, 0x54, 0x24, 0x40, 0x49, 0x89, 0xC6, 0x48, 0x85, 0xC0});
+            patch_to(jump(JNS), body);
+            epilogue();
+
+            patch_to(to_out, m_code.size());
+        }
+
+        // After the call of a , in preemptible code: test rax, rax; jns read;
+        // mov rax, [r12+72]; mov [rax], r14; and return as at the END. read:
+        void wait_for_input()
+        {
+            bytes({0x48, 0x85, 0xC0});
+            const std::size_t to_read = jump(JNS);
+            bytes({0x49, 0x8B, 0x44, 0x24, 0x48, 0x4C, 0x89, 0x30});
+            epilogue();
+            patch_to(to_read, m_code.size());
+        }
+
+        // add qword [r13], weight; add qword [r13+8], 1
+        void count_iteration(std::uint32_t weight)
+        {
+            if (fits_int8(weight))
+            {
+                bytes({0x49, 0x83, 0x45, 0x00});
+                imm(weight, 1);
+            }
+            else
+            {
+                if (weight > std::numeric_limits<std::int32_t>::max())
+                    m_in_range = false;
+                bytes({0x49, 0x81, 0x45, 0x00});
+                imm(weight, 4);
+            }
+            bytes({0x49, 0x83, 0x45, 0x08, 0x01});
+        }
+
+        // lea rax, [rbx+disp32]
+        void lea_rax(std::int64_t disp)
+        {
+            if (disp < std::numeric_limits<std::int32_t>::min() || disp > std::numeric_limits<std::int32_t>::max())
+                m_in_range = false;
+            bytes({0x48, 0x8D, 0x83});
+            imm(disp, 4);
+        }
+
+        // mov rdi, [r12]; mov esi, where; call [r12+32]; ud2, the target of
+        // all the jumps of failed checks on one side
+        void fault_call(const std::pmr::vector<std::size_t> &jumps, BFTapeFault where)
+        {
+            if (jumps.empty())
+                return;
+
+            for (const std::size_t rel32_at : jumps)
+                patch_to(rel32_at, m_code.size());
+
+            bytes({0x49, 0x8B, 0x3C, 0x24, 0xBE});
+            imm(static_cast<std::int64_t>(where), 4);
+            bytes({0x41, 0xFF, 0x54, 0x24, 0x20, 0x0F, 0x0B});
+        }
+
+        // The window in 16, 8 and 4 byte SSE2 adds like add_block(), whatever
+        // is left as scalar ADDs: movdqu/movq/movd xmm0, [rbx+offset];
+        // movdqu/movq/movd xmm1, [rip+deltas]; padd xmm0, xmm1; and back.
+        void add_vector(const BFOp &op, std::span<const std::int32_t> deltas)
+        {
+            std::int32_t k = 0;
+            for (const std::int32_t size : {16, 8, 4})
+            {
+                const auto cells = static_cast<std::int32_t>(size / WIDTH);
+                if (cells < 2)
+                    continue;
+
+                for (; k + cells <= op.arg; k += cells)
+                {
+                    vector_load(size);
+                    cell(0, op.offset + k);
+                    vector_load(size);
+                    constant(1, deltas, static_cast<std::size_t>(op.src + k), static_cast<std::size_t>(cells));
+                    bytes({0x66, 0x0F, PADD, 0xC1});
+                    vector_store(size);
+                    cell(0, op.offset + k);
+                }
+            }
+
+            for (; k < op.arg; ++k)
+                if (const std::int32_t delta = deltas[static_cast<std::size_t>(op.src + k)]; cell_immediate(delta))
+                    alu_imm(OP_ADD, op.offset + k, delta);
+        }
+
+        // the opcode of movdqu/movq/movd xmm, m for a width in bytes
+        void vector_load(std::int32_t size)
+        {
+            if (size == 16)
+                bytes({0xF3, 0x0F, 0x6F});
+            else if (size == 8)
+                bytes({0xF3, 0x0F, 0x7E});
+            else
+                bytes({0x66, 0x0F, 0x6E});
+        }
+
+        // the opcode of movdqu/movq/movd m, xmm
+        void vector_store(std::int32_t size)
+        {
+            if (size == 16)
+                bytes({0xF3, 0x0F, 0x7F});
+            else if (size == 8)
+                bytes({0x66, 0x0F, 0xD6});
+            else
+                bytes({0x66, 0x0F, 0x7E});
+        }
+
+        // ModRM [rip+rel32] of `count` deltas at the cell width, appended to
+        // the constants
+        void constant(std::uint8_t reg, std::span<const std::int32_t> deltas, std::size_t first, std::size_t count)
+        {
+            bytes({static_cast<std::uint8_t>(0x05 | reg << 3)});
+            m_fixups.emplace_back(m_code.size(), m_constants.size());
+            imm(0, 4);
+
+            for (std::size_t i = first; i < first + count; ++i)
+            {
+                const auto bits = static_cast<std::uint32_t>(deltas[i]);
+                for (std::int64_t byte = 0; byte < WIDTH; ++byte)
+                    m_constants.push_back(static_cast<std::uint8_t>(bits >> (8 * byte)));
+            }
+        }
+
+        // mov rdi, [r12]; movzx esi, [rbx+offset]
+        void load_call_args(std::int32_t offset)
+        {
+            bytes({0x49, 0x8B, 0x3C, 0x24});
+            load(ESI, offset);
+        }
+
+        // emits a jmp/jcc with an empty rel32, returns where the rel32 is
+        [[nodiscard]] std::size_t jump(std::uint8_t opcode)
+        {
+            if (opcode == JMP)
+                bytes({JMP});
+            else
+                bytes({0x0F, opcode});
+
+            imm(0, 4);
+            return m_code.size() - 4;
+        }
+
+        void patch_to(std::size_t rel32_at, std::size_t target)
+        {
+            const auto rel = static_cast<std::int32_t>(static_cast<std::int64_t>(target) -
+                                                       static_cast<std::int64_t>(rel32_at + 4));
+            std::memcpy(m_code.data() + rel32_at, &rel, sizeof(rel));
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "parser.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BF_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define BF_HAS_MMAP 0
+#endif
+
+// Feeds a source file to the parser, or anything else taking chunks of
+// it, without ever holding a copy of it: regular files are read straight
+// from a read-only mapping, anything that can't be mapped (pipes, empty
+// files, other platforms) is streamed through in fixed-size chunks.
+class BFSourceLoader
+{
+public:
+    static constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+
+    // false when the file could not be read
+    [[nodiscard]] static bool load(const std::string &path, BFParser &parser)
+    {
+        return load(path, [&](std::string_view chunk) { parser.feed(chunk); });
+    }
+
+    // calls consume(std::string_view) with consecutive chunks of the file
+    template <typename Consume>
+    [[nodiscard]] static bool load(const std::string &path, Consume &&consume)
+    {
+#if BF_HAS_MMAP
+        if (load_mapped(path, consume))
+            return true;
+#endif
+        return load_streamed(path, consume);
+    }
+
+    // Like load(), but hands over whatever a read returns as soon as it
+    // returns, instead of waiting for a whole chunk, so the consumer keeps
+    // up with a pipe. "-" is stdin.
+    template <typename Consume>
+    [[nodiscard]] static bool stream(const std::string &path, Consume &&consume)
+    {
+#if BF_HAS_MMAP
+        const int fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        const auto chunk = std::make_unique_for_overwrite<char[]>(CHUNK_SIZE);
+        ssize_t size;
+        while ((size = read(fd, chunk.get(), CHUNK_SIZE)) != 0)
+        {
+            if (size < 0 && errno == EINTR)
+                continue;
+            if (size < 0)
+                break;
+
+            consume(std::string_view{chunk.get(), static_cast<std::size_t>(size)});
+        }
+
+        if (fd != STDIN_FILENO)
+            close(fd);
+        return size == 0;
+#else
+        if (path == "-")
+        {
+            const auto chunk = std::make_unique_for_overwrite<char[]>(CHUNK_SIZE);
+            while (std::cin)
+            {
+                std::cin.read(chunk.get(), 1);
+                std::streamsize size = std::cin.gcount();
+                size += std::cin.readsome(chunk.get() + size, CHUNK_SIZE - 1);
+                consume(std::string_view{chunk.get(), static_cast<std::size_t>(size)});
+            }
+
+            return std::cin.eof();
+        }
+
+        return load_streamed(path, consume);
+#endif
+    }
+
+private:
+#if BF_HAS_MMAP
+    template <typename Consume>
+    [[nodiscard]] static bool load_mapped(const std::string &path, Consume &consume)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat info{};
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        const auto size = static_cast<std::size_t>(info.st_size);
+        void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED)
+            return false;
+
+        madvise(memory, size, MADV_SEQUENTIAL);
+        consume(std::string_view{static_cast<const char *>(memory), size});
+        munmap(memory, size);
+        return true;
+    }
+#endif
+
+    template <typename Consume>
+    [[nodiscard]] static bool load_streamed(const std::string &path, Consume &consume)
+    {
+        std::ifstream file{path, std::ifstream::binary};
+        if (!file)
+            return false;
+
+        const auto chunk = std::make_unique_for_overwrite<char[]>(CHUNK_SIZE);
+        while (file)
+        {
+            file.read(chunk.get(), CHUNK_SIZE);
+            consume(std::string_view{chunk.get(), static_cast<std::size_t>(file.gcount())});
+        }
+
+        return file.eof();
+    }
+};
@@ -1,248 +1,468 @@
-#include <iostream>
-#include <filesystem>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
-#include <utility>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
 #include <vector>
-#include <ranges>
 
-enum class BFInstruction
+#include "batch.hpp"
+#include "bounds.hpp"
+#include "cache.hpp"
+#include "emit.hpp"
+#include "execution.hpp"
+#include "ir.hpp"
+#include "loader.hpp"
+#include "program.hpp"
+#include "session.hpp"
+#include "stats.hpp"
+#include "stream.hpp"
+
+[[nodiscard]] static bool parse_size(std::string_view text, std::size_t &value)
 {
-    INCR_PTR,      // >
-    DECR_PTR,      // <
-    INCR_BYTE,     // +
-    DECR_BYTE,     // -
-    OUT_BYTE,      // .
-    READ_BYTE,     // ,
-    WHILE_BEGIN,   // [
-    WHILE_END,     // ]
-    COMMENT,       // literally anything else
-    END_OF_PROGRAM // end of file/program
-};
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return error == std::errc{} && end == text.data() + text.size();
+}
 
-class BFInterpreter
+// what the command line does with a program, with the cells of main()
+struct BFCommand
 {
-public:
-    using Byte = unsigned char;
-    static constexpr std::size_t BF_PTR_SIZE = 30'000;
-
-private:
-    BFInstruction m_inst;
-
-    Byte m_tape[BFInterpreter::BF_PTR_SIZE];
-    Byte *m_ptr;
-
-    std::string_view m_input_file_path;
-
-    std::istream &m_input_stream;
-    std::ostream &m_output_stream;
+    const char *path = nullptr;
+    bool bytecode = false; // the input is a file written by --compile
+    bool dump_ir = false;
+    std::string_view emit;
+    std::string compile;
+    BFCompileOptions compile_options;
+    BFRunOptions run_options;
+    bool stream = false; // run the source while reading it
+    bool batch = false;
+    std::vector<const char *> inputs; // of --batch, run in this order
+    BFBatchOptions batch_options;
+    bool serve = false; // run the program for every connection to a port
+    BFServeOptions serve_options;
+    std::string stats; // where --stats writes, - for stderr, empty for nowhere
+};
 
-    std::vector<BFInstruction> m_insts;
-    std::vector<BFInstruction>::iterator m_insts_iter;
+// the JSON of --stats, after the program's own output; false when its file
+// could not be written
+[[nodiscard]] static bool report_stats(const BFCommand &command, const BFStats &stats)
+{
+    if (command.stats.empty())
+        return true;
 
-public:
-    BFInterpreter(std::string_view input_file,
-                  std::istream &inp_stream = std::cin,
-                  std::ostream &out_stream = std::cout)
-        : m_input_file_path{std::move(input_file)},
-          m_input_stream{inp_stream},
-          m_output_stream{out_stream}
+    std::cout.flush();
+    if (command.stats == "-")
     {
-        if (!std::filesystem::exists(m_input_file_path))
-        {
-            std::cerr << "Invalid input file.\n";
-            exit(1);
-        }
-
-        std::fill(std::begin(m_tape), std::end(m_tape), 0);
-        m_ptr = m_tape;
-
-        parse_insts();
-
-        m_inst = BFInstruction::COMMENT;
+        stats.write_json(std::cerr);
+        return true;
     }
 
-    [[nodiscard]] const std::string_view &get_path() const noexcept
+    std::ofstream file{command.stats};
+    stats.write_json(file);
+    file.close();
+    if (!file)
     {
-        return m_input_file_path;
+        std::cerr << "Could not write " << command.stats << ".\n";
+        return false;
     }
 
-    void run()
+    return true;
+}
+
+// the outputs go to stdout in input order, failures to stderr
+template <typename Cell>
+static int execute_batch(const BFCompiledProgram::Pointer &program, const BFCommand &command)
+{
+    bool failed = false;
+    BFStats stats;
+    const auto load = [&](std::size_t i) -> std::expected<std::string, BFError>
     {
-        while (true)
+        std::ifstream file{command.inputs[i], std::ifstream::binary};
+        std::string input{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+        if (!file && !file.eof())
+            return std::unexpected{BFError{BFErrorCode::IO, "Could not read input file."}};
+        return input;
+    };
+
+    const auto collect = [&](std::size_t i, BFBatchResult result)
+    {
+        std::cout.write(result.output.data(), static_cast<std::streamsize>(result.output.size()));
+        stats += result.stats;
+        if (result.error)
         {
-            m_inst = next_inst();
-
-            switch (m_inst)
-            {
-            case BFInstruction::INCR_PTR:
-                ++m_ptr;
-                break;
-
-            case BFInstruction::DECR_PTR:
-                --m_ptr;
-                break;
-
-            case BFInstruction::INCR_BYTE:
-                ++*m_ptr;
-                break;
-
-            case BFInstruction::DECR_BYTE:
-                --*m_ptr;
-                break;
-
-            case BFInstruction::OUT_BYTE:
-                m_output_stream << *m_ptr;
-                break;
+            std::cout.flush();
+            std::cerr << command.inputs[i] << ": " << result.error->message << '\n';
+            failed = true;
+        }
+    };
 
-            case BFInstruction::READ_BYTE:
-                m_input_stream >> *m_ptr;
-                break;
+    const auto ran = BFBatch<Cell>::run(program, command.run_options, command.batch_options, command.inputs.size(),
+                                        load, collect);
+    if (!ran)
+    {
+        std::cerr << ran.error().message << '\n';
+        return 1;
+    }
 
-            case BFInstruction::WHILE_BEGIN:
-                if (*m_ptr == 0)
-                    skip_loop();
-                break;
+    std::cout.flush();
+    if (!report_stats(command, stats))
+        return 1;
+    return failed ? 1 : 0;
+}
 
-            case BFInstruction::WHILE_END:
-                if (*m_ptr)
-                    restart_loop();
-                break;
+template <typename Cell>
+static int execute(const BFCommand &command)
+{
+    const BFRunOptions &options = command.run_options;
 
-            case BFInstruction::COMMENT:
-                continue;
+    if (command.stream)
+    {
+        // stdin carries the program, the program reads nothing
+        std::istringstream no_input;
+        std::istream &in = std::string_view{command.path} == "-" ? no_input : std::cin;
 
-            case BFInstruction::END_OF_PROGRAM:
-                return;
+        BFStats stats;
+        const auto ran = run_streamed<Cell>(command.path, command.compile_options.optimize, options, in, std::cout,
+                                            &stats);
+        if (!ran)
+            std::cerr << ran.error().message << '\n';
 
-            default:
-                std::unreachable();
-            }
-        }
+        return report_stats(command, stats) && ran ? 0 : 1;
     }
 
-private:
-    void parse_insts()
+    const auto program = command.bytecode ? BFCompiledProgram::from_bytecode(command.path)
+                                          : BFCompiledProgram::from_file(command.path, command.compile_options);
+    if (!program)
     {
-        std::ifstream file;
-        file.open(std::string{m_input_file_path}, std::ifstream::binary);
-        file.seekg(0, std::ios::end);
-
-        std::vector<char> bf_code;
-        std::streampos file_length(file.tellg());
-        if (!file_length)
-            return;
+        std::cerr << program.error().message << '\n';
+        return 1;
+    }
 
-        file.seekg(0, std::ios::beg);
-        bf_code.resize(static_cast<std::size_t>(file_length));
-        // +1 for end of program instruction
-        m_insts.resize(static_cast<std::size_t>(file_length) + 1, BFInstruction::COMMENT);
-        file.read(&bf_code.front(), static_cast<std::size_t>(file_length));
+    const BFProgramView code = (*program)->code();
+    if (!command.compile.empty())
+    {
+        BFHasher hasher;
+        if (!command.bytecode)
+            (void)BFSourceLoader::load(command.path, [&](std::string_view chunk) { hasher.update(chunk); });
 
-        BFInstruction next;
-        for (const auto &[i, c] : std::views::enumerate(bf_code))
+        if (!BFBytecode::write(command.compile, code, command.compile_options.optimize, hasher.digest()))
         {
-            next = to_inst(c);
-            if (next == BFInstruction::COMMENT)
-                continue;
-
-            m_insts[static_cast<std::size_t>(i)] = std::move(next);
+            std::cerr << "Could not write " << command.compile << ".\n";
+            return 1;
         }
 
-        m_insts[file_length] = BFInstruction::END_OF_PROGRAM;
-        m_insts_iter = m_insts.begin() - 1;
+        return 0;
     }
 
-    void skip_loop()
+    if (command.dump_ir)
     {
-        if (m_inst == BFInstruction::WHILE_BEGIN)
-        {
-            int loops = 1;
-            while (loops > 0)
-            {
-                m_inst = next_inst();
-                if (m_inst == BFInstruction::WHILE_BEGIN)
-                    loops++;
-                else if (m_inst == BFInstruction::WHILE_END)
-                    loops--;
-            }
-        }
+        dump(std::cout, code);
+        return 0;
     }
 
-    void restart_loop()
+    const BFBounds *const bounds = options.check_bounds ? &(*program)->bounds() : nullptr;
+    if (command.emit == "c")
     {
-        if (m_inst == BFInstruction::WHILE_END)
-        {
-            int loops = 1;
-            while (loops > 0)
-            {
-                m_inst = prev_inst();
-                if (m_inst == BFInstruction::WHILE_BEGIN)
-                    loops--;
-                else if (m_inst == BFInstruction::WHILE_END)
-                    loops++;
-            }
-        }
+        emit_c<Cell>(std::cout, code, options.tape_size, options.eof, bounds);
+        return 0;
     }
 
-    [[nodiscard]] inline BFInstruction next_inst()
+    if (command.emit == "asm")
     {
-        return m_insts_iter == m_insts.end() ? *m_insts_iter : *++m_insts_iter;
+        emit_asm<Cell>(std::cout, code, options.tape_size, options.eof, bounds);
+        return 0;
     }
 
-    [[nodiscard]] inline BFInstruction prev_inst()
+    if (command.batch)
+        return execute_batch<Cell>(*program, command);
+
+    if (command.serve)
     {
-        return m_insts_iter == m_insts.begin() ? *m_insts_iter : *--m_insts_iter;
+#if BF_HAS_REACTOR
+        const auto served = serve<Cell>(*program, options, command.serve_options);
+        std::cerr << served.error().message << '\n';
+#else
+        std::cerr << "--serve needs epoll, which this platform lacks.\n";
+#endif
+        return 1;
     }
 
-    [[nodiscard]] BFInstruction to_inst(char c) noexcept
+    const auto execution = BFExecution<Cell>::create(*program, options);
+    if (!execution)
     {
-        switch (c)
-        {
-        case '>':
-            return BFInstruction::INCR_PTR;
-
-        case '<':
-            return BFInstruction::DECR_PTR;
-
-        case '+':
-            return BFInstruction::INCR_BYTE;
-
-        case '-':
-            return BFInstruction::DECR_BYTE;
-
-        case '.':
-            return BFInstruction::OUT_BYTE;
-
-        case ',':
-            return BFInstruction::READ_BYTE;
-
-        case '[':
-            return BFInstruction::WHILE_BEGIN;
-
-        case ']':
-            return BFInstruction::WHILE_END;
+        std::cerr << execution.error().message << '\n';
+        return 1;
+    }
 
-        default:
-            return BFInstruction::COMMENT;
-        }
+    const auto result = (*execution)->run();
+    if (!result)
+        std::cerr << result.error().message << '\n';
 
-        std::unreachable();
-    }
-};
+    return report_stats(command, (*execution)->stats()) && result ? 0 : 1;
+}
 
 int main(int argc, char **argv)
 {
     const char *USAGE = R"==(Usage
 
-    bf-interpreter <path-to-source>
+    bf-interpreter [options] <path-to-source>
+
+Options
+
+    -O<level>    optimization level, 0 to 5 (default 5), each level
+                 enables one more pass:
+                   1  clear loops     [-]        -> SET [ptr], 0
+                   2  scan loops      [>]        -> SCAN 1
+                   3  multiply loops  [->++<]    -> MUL_ADD [ptr+1], [ptr], 2; SET [ptr], 0
+                   4  offset cells    >+>>-<<    -> ADD [ptr+1], 1; ADD [ptr+3], -1; MOVE 1
+                   5  vector adds     +>+>++>->+>+>+>+
+                                                 -> ADD_VEC [ptr], {1, 1, 2, -1, 1, 1, 1, 1}
+    --engine=<name>
+                 execution engine:
+                   switch    one switch over the IR (default)
+                   threaded  direct-threaded code using computed goto
+                   jit       native x86-64 code, threaded elsewhere
+                   tiered    threaded, compiling loops to native code
+                             once they turn hot
+    --emit=<lang>
+                 print a standalone program instead of running it:
+                   c         C source
+                   asm       x86-64 assembly (GNU as)
+    --output-buffer=<bytes>
+                 output buffer size (default 65536), output is also
+                 flushed before waiting for input and at the end
+    --unbuffered write every output byte straight through, for terminals
+    --eof=<mode> what , stores at end of input:
+                   unchanged leave the cell as it is (default)
+                   0         store 0
+                   -1        store -1
+    --cell-bits=<n>
+                 cell width, 8 (default), 16 or 32 bits, cells wrap, . writes
+                 the low 8 bits and , stores the byte zero-extended
+    --tape-size=<cells>
+                 number of tape cells (default 30000), rounded up to whole
+                 pages where there are guard pages, so a program may use a
+                 few cells more, with --check-bounds as well; moving off
+                 either end stops the program with an error
+    --check-bounds
+                 check the tape pointer against the ends of the tape once
+                 per block and loop entry, instead of relying on guard pages;
+                 also makes --emit check it (default where there are no
+                 guard pages)
+    --profile    run the instrumented switch engine and report the hottest
+                 ops and loops, by source line:col, on stderr
+    --profile-folded=<path>
+                 like --profile, but write folded stacks of the loop nests
+                 weighted by ops executed, for flamegraph.pl
+    --cache[=<dir>]
+                 keep the optimized IR and JIT code of every program run in
+                 a cache directory (default $XDG_CACHE_HOME/bf-interpreter
+                 or ~/.cache/bf-interpreter) and skip parsing on later runs,
+                 entries of a changed source, option or build are not used;
+                 only a directory no other user may write to is used
+    --precompute[=<ops>]
+                 run the start of the program that reads no input, up to
+                 <ops> ops (default 100000000), while compiling and start
+                 every run from the state it leaves; pays off with --cache,
+                 --compile, --emit and --batch
+    --compile=<path>
+                 write the optimized program to a bytecode file instead of
+                 running it
+    --run-bytecode
+                 the input is a bytecode file from --compile, run as it is
+                 with no parsing (-O and --cache don't apply)
+    --stream     run the source while it is still being read, each piece
+                 once its brackets balance, for programs piped in; the
+                 path - reads the program from stdin, which leaves the
+                 program itself no input
+    --batch <path-to-source> <input>...
+                 run the program once per input file, on a pool of threads,
+                 and write the outputs to stdout in input order
+    --serve=<port>
+                 run the program for every TCP connection to <port>, with
+                 what the peer sends as input and its output sent back; a
+                 , with no input waits without holding up a thread, and
+                 sessions take turns every 1048576 ops
+    --threads=<n>
+                 worker threads of --batch and --serve (default one per
+                 hardware thread)
+    --max-steps=<ops>
+                 stop the program with an error once it has run <ops> ops,
+                 counted as --stats counts them and checked at loop
+                 back-edges; with --stream for all pieces together, with
+                 --batch for each input
+    --time-limit=<ms>
+                 the same for <ms> milliseconds of wall-clock time, input
+                 waited for included
+    --stats[=<path>]
+                 count ops, loop iterations, I/O bytes and time and the
+                 tape cells reached, and write them as JSON to stderr, or
+                 to <path>, at exit
+    --dump-ir    print the optimized IR instead of running the program
     )==";
 
-    if (argc < 2)
+    BFCommand command;
+    BFRunOptions &options = command.run_options;
+    int cell_bits = 8;
+    std::size_t prefix_steps = 0; // -O<n> may come after it
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg{argv[i]};
+        if (arg == "--dump-ir")
+            command.dump_ir = true;
+        else if (arg == "--emit=c" || arg == "--emit=asm")
+            command.emit = arg.substr(7);
+        else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' &&
+                 arg[2] <= '0' + BFOptimizeOptions::MAX_LEVEL)
+            command.compile_options.optimize = BFOptimizeOptions::from_level(arg[2] - '0');
+        else if (arg == "--engine=switch")
+            options.engine = BFEngine::SWITCH;
+        else if (arg == "--engine=threaded")
+            options.engine = BFEngine::THREADED;
+        else if (arg == "--engine=jit")
+            options.engine = BFEngine::JIT;
+        else if (arg == "--engine=tiered")
+            options.engine = BFEngine::TIERED;
+        else if (arg.starts_with("--output-buffer="))
+        {
+            if (!parse_size(arg.substr(16), options.output_buffer))
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+        }
+        else if (arg.starts_with("--tape-size="))
+        {
+            if (!parse_size(arg.substr(12), options.tape_size) || options.tape_size == 0)
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+        }
+        else if (arg == "--cell-bits=8" || arg == "--cell-bits=16" || arg == "--cell-bits=32")
+            std::from_chars(arg.data() + 12, arg.data() + arg.size(), cell_bits);
+        else if (arg == "--check-bounds")
+            options.check_bounds = true;
+        else if (arg == "--profile")
+            options.profile = &std::cerr;
+        else if (arg.starts_with("--profile-folded=") && arg.size() > 17)
+            options.profile_folded = arg.substr(17);
+        else if (arg == "--cache")
+            command.compile_options.cache_dir = BFProgramCache::default_directory().string();
+        else if (arg.starts_with("--cache=") && arg.size() > 8)
+            command.compile_options.cache_dir = arg.substr(8);
+        else if (arg == "--precompute")
+            prefix_steps = BFOptimizeOptions::DEFAULT_PREFIX_STEPS;
+        else if (arg.starts_with("--precompute="))
+        {
+            if (!parse_size(arg.substr(13), prefix_steps) || prefix_steps == 0)
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+        }
+        else if (arg.starts_with("--compile=") && arg.size() > 10)
+            command.compile = arg.substr(10);
+        else if (arg == "--run-bytecode")
+            command.bytecode = true;
+        else if (arg == "--stream")
+            command.stream = true;
+        else if (arg == "--batch")
+            command.batch = true;
+        else if (arg.starts_with("--threads="))
+        {
+            if (!parse_size(arg.substr(10), command.batch_options.threads) || command.batch_options.threads == 0)
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+            command.serve_options.threads = command.batch_options.threads;
+        }
+        else if (arg.starts_with("--serve="))
+        {
+            std::size_t port = 0;
+            if (!parse_size(arg.substr(8), port) || port == 0 || port > 65535)
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+            command.serve = true;
+            command.serve_options.port = static_cast<std::uint16_t>(port);
+        }
+        else if (arg.starts_with("--max-steps="))
+        {
+            std::size_t steps = 0;
+            if (!parse_size(arg.substr(12), steps) || steps == 0)
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+            options.limits.steps = steps;
+        }
+        else if (arg.starts_with("--time-limit="))
+        {
+            std::size_t milliseconds = 0;
+            if (!parse_size(arg.substr(13), milliseconds) || milliseconds == 0)
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+            options.limits.time = std::chrono::milliseconds{static_cast<std::chrono::milliseconds::rep>(milliseconds)};
+        }
+        else if (arg == "--stats")
+        {
+            options.stats = true;
+            command.stats = "-";
+        }
+        else if (arg.starts_with("--stats=") && arg.size() > 8)
+        {
+            options.stats = true;
+            command.stats = arg.substr(8);
+        }
+        else if (arg == "--unbuffered")
+            options.output_buffer = 0;
+        else if (arg == "--eof=unchanged")
+            options.eof = BFEofMode::UNCHANGED;
+        else if (arg == "--eof=0")
+            options.eof = BFEofMode::ZERO;
+        else if (arg == "--eof=-1")
+            options.eof = BFEofMode::MINUS_ONE;
+        else if (arg.starts_with("--"))
+        {
+            std::cerr << USAGE;
+            return 1;
+        }
+        else if (!command.path)
+            command.path = argv[i];
+        else
+            command.inputs.push_back(argv[i]);
+    }
+
+    const bool runs_source = !command.dump_ir && command.emit.empty() && command.compile.empty();
+    if (!command.path || (!command.batch && !command.inputs.empty()) ||
+        (command.stream && (command.batch || command.bytecode || !runs_source)) ||
+        (command.serve && (command.batch || command.stream || !runs_source)))
     {
         std::cerr << USAGE;
         return 1;
     }
 
-    BFInterpreter bf{argv[1]};
-    bf.run();
+    command.compile_options.optimize.prefix_steps = prefix_steps;
+    std::ios::sync_with_stdio(false);
+
+    switch (cell_bits)
+    {
+    case 16:
+        return execute<std::uint16_t>(command);
+
+    case 32:
+        return execute<std::uint32_t>(command);
+
+    default:
+        return execute<std::uint8_t>(command);
+    }
 }
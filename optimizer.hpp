@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory_resource>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+#include "prefix.hpp"
+
+// Every pass can be switched on its own. -O<n> enables the first n passes
+// in the order below, so a miscompile can be bisected by level.
+struct BFOptimizeOptions
+{
+    static constexpr int MAX_LEVEL = 5;
+
+    bool clear_loops = true;    // [-] [+]           -> SET [ptr], 0
+    bool scan_loops = true;     // [>] [<] [>>] ...  -> SCAN n
+    bool multiply_loops = true; // [->+>++<<]        -> MUL_ADD [ptr+1], [ptr], 1; ...; SET [ptr], 0
+    bool offset_cells = true;   // >+>>-<<           -> ADD [ptr+1], 1; ADD [ptr+3], -1; MOVE 1
+    bool vector_adds = true;    // +>+>++>->+>+>+>+  -> ADD_VEC [ptr], {1, 1, 2, -1, 1, 1, 1, 1}
+
+    // ops to run at compile time for the prefix, 0 for none (see evaluate_prefix())
+    static constexpr std::uint64_t DEFAULT_PREFIX_STEPS = 100'000'000;
+    std::uint64_t prefix_steps = 0;
+
+    [[nodiscard]] static constexpr BFOptimizeOptions from_level(int level) noexcept
+    {
+        return BFOptimizeOptions{
+            .clear_loops = level >= 1,
+            .scan_loops = level >= 2,
+            .multiply_loops = level >= 3,
+            .offset_cells = level >= 4,
+            .vector_adds = level >= 5,
+        };
+    }
+};
+
+// Each pass builds its output, and whatever it keeps on the way, in the
+// scratch memory given (see BFArena), and copies the result back over the
+// program's ops, which no pass makes longer.
+class BFOptimizer
+{
+public:
+    static constexpr std::int32_t VECTOR_CELLS = 16; // the widest window one ADD_VEC covers
+    static constexpr std::size_t VECTOR_MIN_ADDS = 8;
+
+private:
+    BFOptimizeOptions m_options;
+    std::pmr::memory_resource *m_scratch;
+
+public:
+    explicit BFOptimizer(BFOptimizeOptions options = {},
+                         std::pmr::memory_resource *scratch = std::pmr::get_default_resource()) noexcept
+        : m_options{options}, m_scratch{scratch}
+    {
+    }
+
+    void optimize(BFProgram &program) const
+    {
+        if (m_options.clear_loops)
+            rewrite_loops(program, clear_loop, m_scratch);
+
+        if (m_options.scan_loops)
+            rewrite_loops(program, scan_loop, m_scratch);
+
+        if (m_options.multiply_loops)
+            rewrite_loops(program, multiply_loop, m_scratch);
+
+        if (m_options.offset_cells)
+            offset_cells(program, m_scratch);
+
+        if (m_options.vector_adds)
+            vector_adds(program, m_scratch);
+
+        if (m_options.prefix_steps)
+            evaluate_prefix(program, m_options.prefix_steps, m_scratch);
+    }
+
+private:
+    using Body = std::span<const BFOp>;
+    using Ops = std::pmr::vector<BFOp>;
+
+    // the output of a pass as the program's ops
+    static void replace_ops(BFProgram &program, const Ops &out, std::pmr::memory_resource *scratch)
+    {
+        program.ops.assign(out.begin(), out.end());
+        link_loops(program, scratch);
+    }
+
+    // Offers the body of every innermost loop to `rewrite`, which either
+    // appends a replacement for the whole loop to `out` and returns true,
+    // or leaves `out` untouched and returns false.
+    template <typename Rewrite>
+    static void rewrite_loops(BFProgram &program, Rewrite rewrite, std::pmr::memory_resource *scratch)
+    {
+        Ops out{scratch};
+        out.reserve(program.ops.size());
+
+        const std::vector<BFOp> &ops = program.ops;
+        for (std::size_t i = 0; i < ops.size(); ++i)
+        {
+            if (ops[i].code == BFOpCode::LOOP_BEGIN)
+            {
+                const Body body{ops.data() + i + 1, ops[i].jump - i - 1};
+                if (is_innermost(body) && rewrite(ops[i], body, out))
+                {
+                    i = ops[i].jump;
+                    continue;
+                }
+            }
+
+            out.push_back(ops[i]);
+        }
+
+        replace_ops(program, out, scratch);
+    }
+
+    [[nodiscard]] static bool is_innermost(Body body) noexcept
+    {
+        for (const BFOp &op : body)
+            if (op.code == BFOpCode::LOOP_BEGIN)
+                return false;
+
+        return true;
+    }
+
+    [[nodiscard]] static bool clear_loop(const BFOp &loop, Body body, Ops &out)
+    {
+        if (body.size() != 1 || body[0].code != BFOpCode::ADD || (body[0].arg != 1 && body[0].arg != -1))
+            return false;
+
+        out.push_back(BFOp{.code = BFOpCode::SET, .arg = 0, .loc = loop.loc});
+        return true;
+    }
+
+    [[nodiscard]] static bool scan_loop(const BFOp &loop, Body body, Ops &out)
+    {
+        if (body.size() != 1 || body[0].code != BFOpCode::MOVE)
+            return false;
+
+        out.push_back(BFOp{.code = BFOpCode::SCAN, .arg = body[0].arg, .loc = loop.loc});
+        return true;
+    }
+
+    // A loop of only ADD/MOVE with no net pointer movement, which steps its
+    // own cell by exactly 1, runs (-cell * step) mod 2^bits times. Every
+    // other cell it touches just gets that count times its delta added.
+    [[nodiscard]] static bool multiply_loop(const BFOp &loop, Body body, Ops &out)
+    {
+        std::pmr::map<std::int32_t, std::int64_t> deltas{out.get_allocator()};
+        std::int64_t ptr = 0;
+
+        for (const BFOp &op : body)
+        {
+            if (op.code == BFOpCode::ADD)
+                deltas[static_cast<std::int32_t>(ptr)] += op.arg;
+            else if (op.code == BFOpCode::MOVE)
+                ptr += op.arg;
+            else
+                return false;
+
+            if (!is_within_reach(ptr))
+                return false;
+        }
+
+        if (ptr != 0)
+            return false;
+
+        const std::int64_t step = deltas[0];
+        if (step != 1 && step != -1)
+            return false;
+
+        for (const auto &[offset, delta] : deltas)
+        {
+            if (offset == 0 || delta == 0)
+                continue;
+
+            // factors wrap like cells do, so truncating to 32 bits is exact
+            const auto factor = static_cast<std::uint32_t>(-step * delta);
+            out.push_back(BFOp{.code = BFOpCode::MUL_ADD,
+                               .arg = static_cast<std::int32_t>(factor),
+                               .offset = offset,
+                               .loc = loop.loc});
+        }
+
+        out.push_back(BFOp{.code = BFOpCode::SET, .arg = 0, .loc = loop.loc});
+        return true;
+    }
+
+    // Defers pointer moves across each basic block: cell ops address their
+    // cell relative to where the block started and a single MOVE settles the
+    // pointer before the next loop bracket, scan or the end of the program,
+    // or once the offset would grow past BFOp::MAX_REACH. Where the ops
+    // between two MOVEs merged away, a probe goes between them.
+    static void offset_cells(BFProgram &program, std::pmr::memory_resource *scratch)
+    {
+        Ops out{scratch};
+        out.reserve(program.ops.size());
+
+        std::int64_t delta = 0;
+        BFSourceLoc move_loc{};
+
+        const auto settle = [&]
+        {
+            if (delta == 0)
+                return;
+
+            if (!out.empty() && out.back().code == BFOpCode::MOVE)
+                out.push_back(BFOp{.code = BFOpCode::ADD, .arg = 0, .loc = move_loc});
+            out.push_back(BFOp{.code = BFOpCode::MOVE, .arg = static_cast<std::int32_t>(delta), .loc = move_loc});
+            delta = 0;
+        };
+
+        for (BFOp op : program.ops)
+        {
+            switch (op.code)
+            {
+            case BFOpCode::MOVE:
+                if (!is_within_reach(delta + op.arg))
+                    settle();
+                if (delta == 0)
+                    move_loc = op.loc;
+                delta += op.arg;
+                continue;
+
+            case BFOpCode::ADD:
+                op.offset = static_cast<std::int32_t>(delta);
+                if (merge_add(out, op))
+                    continue;
+                break;
+
+            case BFOpCode::SET:
+            case BFOpCode::OUT:
+            case BFOpCode::IN:
+                op.offset = static_cast<std::int32_t>(delta);
+                break;
+
+            case BFOpCode::MUL_ADD:
+                if (!is_within_reach(op.offset + delta) || !is_within_reach(op.src + delta))
+                    settle();
+                op.offset += static_cast<std::int32_t>(delta);
+                op.src += static_cast<std::int32_t>(delta);
+                break;
+
+            default:
+                settle();
+                break;
+            }
+
+            out.push_back(op);
+        }
+
+        replace_ops(program, out, scratch);
+    }
+
+    // folds an ADD into a directly preceding ADD or SET of the same cell
+    [[nodiscard]] static bool merge_add(Ops &out, const BFOp &add)
+    {
+        if (out.empty())
+            return false;
+
+        BFOp &last = out.back();
+        if ((last.code != BFOpCode::ADD && last.code != BFOpCode::SET) || last.offset != add.offset)
+            return false;
+
+        last.arg = static_cast<std::int32_t>(static_cast<std::uint32_t>(last.arg) + static_cast<std::uint32_t>(add.arg));
+        if (last.code == BFOpCode::ADD && last.arg == 0)
+            out.pop_back();
+
+        return true;
+    }
+
+    // Packs runs of ADDs into ADD_VEC where at least VECTOR_MIN_ADDS of them
+    // land within VECTOR_CELLS cells, so the engines can apply them as one
+    // vector add. Runs are what offset_cells leaves of a basic block, and
+    // their order doesn't matter. Cells inside the window that the run
+    // didn't touch get a delta of 0.
+    static void vector_adds(BFProgram &program, std::pmr::memory_resource *scratch)
+    {
+        Ops out{scratch};
+        out.reserve(program.ops.size());
+        program.deltas.clear();
+
+        const std::vector<BFOp> &ops = program.ops;
+        for (std::size_t i = 0; i < ops.size();)
+        {
+            if (ops[i].code != BFOpCode::ADD)
+            {
+                out.push_back(ops[i++]);
+                continue;
+            }
+
+            // offset -> the run's ADD of that cell, summed
+            std::pmr::map<std::int32_t, BFOp> adds{scratch};
+            for (; ops[i].code == BFOpCode::ADD; ++i)
+            {
+                const auto [it, inserted] = adds.try_emplace(ops[i].offset, ops[i]);
+                if (!inserted)
+                    it->second.arg = static_cast<std::int32_t>(static_cast<std::uint32_t>(it->second.arg) +
+                                                               static_cast<std::uint32_t>(ops[i].arg));
+            }
+
+            for (auto first = adds.begin(); first != adds.end();)
+            {
+                auto last = first;
+                std::size_t count = 0;
+                while (last != adds.end() && last->first - first->first < VECTOR_CELLS)
+                {
+                    ++last;
+                    ++count;
+                }
+
+                if (count < VECTOR_MIN_ADDS)
+                {
+                    out.push_back(first->second);
+                    ++first;
+                    continue;
+                }
+
+                const std::int32_t begin = first->first;
+                const std::int32_t width = std::prev(last)->first - begin + 1;
+                out.push_back(BFOp{.code = BFOpCode::ADD_VEC,
+                                   .arg = width,
+                                   .offset = begin,
+                                   .src = static_cast<std::int32_t>(program.deltas.size()),
+                                   .loc = first->second.loc});
+
+                program.deltas.resize(program.deltas.size() + static_cast<std::size_t>(width));
+                for (; first != last; ++first)
+                    program.deltas[program.deltas.size() - static_cast<std::size_t>(width) +
+                                   static_cast<std::size_t>(first->first - begin)] = first->second.arg;
+            }
+        }
+
+        replace_ops(program, out, scratch);
+    }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <limits>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+
+struct BFSyntaxError
+{
+    BFSourceLoc loc;
+    char bracket; // the unmatched '[' or ']'
+};
+
+// Lexes bf source into the folded IR. Comments are dropped and runs of
+// +- and >< are folded into single ADD/MOVE ops. Source can be fed in
+// arbitrary chunks.
+class BFParser
+{
+private:
+    std::vector<BFOp> m_ops;
+    std::vector<std::uint32_t> m_open_loops;
+    bool m_taken_move = false; // the last op take_balanced() handed out was a MOVE
+
+    // the run currently being folded, flushed on the first other op
+    BFOpCode m_run_code = BFOpCode::END;
+    std::int64_t m_run_value = 0;
+    BFSourceLoc m_run_loc{};
+
+    BFSourceLoc m_loc{};
+    std::optional<BFSyntaxError> m_error;
+
+public:
+    [[nodiscard]] static std::expected<BFProgram, BFSyntaxError> parse(std::string_view source)
+    {
+        BFParser parser;
+        parser.feed(source);
+        return parser.finish();
+    }
+
+    void feed(std::string_view chunk)
+    {
+        if (m_error)
+            return;
+
+        for (const char c : chunk)
+        {
+            switch (c)
+            {
+            case '+':
+                fold(BFOpCode::ADD, 1);
+                break;
+
+            case '-':
+                fold(BFOpCode::ADD, -1);
+                break;
+
+            case '>':
+                fold(BFOpCode::MOVE, 1);
+                break;
+
+            case '<':
+                fold(BFOpCode::MOVE, -1);
+                break;
+
+            case '.':
+                emit(BFOpCode::OUT);
+                break;
+
+            case ',':
+                emit(BFOpCode::IN);
+                break;
+
+            case '[':
+                emit(BFOpCode::LOOP_BEGIN);
+                m_open_loops.push_back(static_cast<std::uint32_t>(m_ops.size() - 1));
+                break;
+
+            case ']':
+                if (m_open_loops.empty())
+                {
+                    m_error = BFSyntaxError{m_loc, ']'};
+                    return;
+                }
+
+                emit(BFOpCode::LOOP_END);
+                m_ops.back().jump = m_open_loops.back();
+                m_ops[m_open_loops.back()].jump = static_cast<std::uint32_t>(m_ops.size() - 1);
+                m_open_loops.pop_back();
+                break;
+
+            default:
+                break;
+            }
+
+            if (c == '\n')
+            {
+                ++m_loc.line;
+                m_loc.column = 1;
+            }
+            else
+                ++m_loc.column;
+        }
+    }
+
+    [[nodiscard]] bool failed() const noexcept
+    {
+        return m_error.has_value();
+    }
+
+    // Takes the ops fed so far up to the outermost loop still open as a
+    // program of their own, so a stream can run piece by piece. The open
+    // loop, and a run still being folded, stay behind for the next piece.
+    [[nodiscard]] std::optional<BFProgram> take_balanced()
+    {
+        const std::size_t balanced = m_open_loops.empty() ? m_ops.size() : m_open_loops.front();
+        if (m_error || balanced == 0)
+            return std::nullopt;
+
+        BFProgram program;
+        program.ops.assign(m_ops.begin(), m_ops.begin() + static_cast<std::ptrdiff_t>(balanced));
+        m_taken_move = program.ops.back().code == BFOpCode::MOVE;
+        program.ops.push_back(BFOp{.code = BFOpCode::END, .loc = m_loc});
+
+        // what stays behind moves to the front, its jumps with it (an open
+        // loop's is only set once it closes)
+        m_ops.erase(m_ops.begin(), m_ops.begin() + static_cast<std::ptrdiff_t>(balanced));
+        const auto shift = static_cast<std::uint32_t>(balanced);
+        for (BFOp &op : m_ops)
+            if (op.code == BFOpCode::LOOP_BEGIN || op.code == BFOpCode::LOOP_END)
+                op.jump -= shift;
+        for (std::uint32_t &open : m_open_loops)
+            open -= shift;
+
+        return program;
+    }
+
+    [[nodiscard]] std::expected<BFProgram, BFSyntaxError> finish()
+    {
+        if (!m_error && !m_open_loops.empty())
+            m_error = BFSyntaxError{m_ops[m_open_loops.back()].loc, '['};
+
+        if (m_error)
+            return std::unexpected(*m_error);
+
+        emit(BFOpCode::END);
+        return BFProgram{std::move(m_ops)};
+    }
+
+private:
+    void fold(BFOpCode code, int step)
+    {
+        const std::int64_t arg_max =
+            code == BFOpCode::MOVE ? BFOp::MAX_REACH : std::numeric_limits<std::int32_t>::max();
+
+        if (m_run_code != code || m_run_value == arg_max || m_run_value == -arg_max)
+        {
+            flush_run();
+            m_run_code = code;
+            m_run_loc = m_loc;
+        }
+
+        m_run_value += step;
+    }
+
+    void flush_run()
+    {
+        // balanced runs like +- or >< cancel out entirely
+        if (m_run_code != BFOpCode::END && m_run_value != 0)
+        {
+            // two moves meet where a long one was split or the run between
+            // them cancelled out, a probe goes between them, also where the
+            // first one ended the piece take_balanced() handed out last
+            const bool after_move = m_ops.empty() ? m_taken_move : m_ops.back().code == BFOpCode::MOVE;
+            if (m_run_code == BFOpCode::MOVE && after_move)
+                m_ops.push_back(BFOp{.code = BFOpCode::ADD, .arg = 0, .loc = m_run_loc});
+
+            m_ops.push_back(BFOp{.code = m_run_code, .arg = static_cast<std::int32_t>(m_run_value), .loc = m_run_loc});
+        }
+
+        m_run_code = BFOpCode::END;
+        m_run_value = 0;
+    }
+
+    void emit(BFOpCode code)
+    {
+        flush_run();
+        m_ops.push_back(BFOp{.code = code, .loc = m_loc});
+    }
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+
+// Runs the start of a program at compile time for evaluate_prefix(), on a
+// tape of Cell that grows as needed. Top-level ops run one at a time, a
+// loop as a whole. The evaluator stops before the first one that can't
+// finish, because it would read input, leave the tape or run out of steps,
+// with everything that op did undone. The tape, journal and output come
+// from scratch.
+template <typename Cell>
+class BFPrefixEvaluator
+{
+private:
+    BFProgramView m_program;
+    std::uint64_t m_steps; // ops left to run
+
+    std::pmr::vector<Cell> m_cells;
+    std::int64_t m_ptr = 0;
+    std::int64_t m_reach = 0;
+    std::pmr::string m_output;
+    std::size_t m_stop = 0; // the next top-level op
+
+    // every cell as it was before the top-level op at hand, once each; a
+    // cell is journaled when m_journaled holds m_stop + 1 for it
+    std::pmr::vector<std::pair<std::size_t, Cell>> m_journal;
+    std::pmr::vector<std::size_t> m_journaled;
+
+public:
+    BFPrefixEvaluator(BFProgramView program, std::uint64_t steps,
+                      std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+        : m_program{program},
+          m_steps{steps},
+          m_cells{scratch},
+          m_output{scratch},
+          m_journal{scratch},
+          m_journaled{scratch}
+    {
+    }
+
+    // runs top-level ops until one can't finish or up to limit, returns
+    // the index of the next one
+    std::size_t run(std::size_t limit = std::numeric_limits<std::size_t>::max())
+    {
+        while (m_stop < limit && m_program.ops[m_stop].code != BFOpCode::END)
+        {
+            const BFOp &op = m_program.ops[m_stop];
+            const std::size_t end = op.code == BFOpCode::LOOP_BEGIN ? op.jump : m_stop;
+
+            const std::int64_t ptr = m_ptr, reach = m_reach;
+            const std::size_t output = m_output.size();
+            m_journal.clear();
+
+            if (!execute(m_stop, end))
+            {
+                for (const auto &[index, value] : m_journal)
+                    m_cells[index] = value;
+                m_ptr = ptr;
+                m_reach = reach;
+                m_output.resize(output);
+                break;
+            }
+
+            m_stop = end + 1;
+        }
+
+        return m_stop;
+    }
+
+    [[nodiscard]] std::size_t stop() const noexcept
+    {
+        return m_stop;
+    }
+
+    [[nodiscard]] std::int64_t pointer() const noexcept
+    {
+        return m_ptr;
+    }
+
+    [[nodiscard]] std::int64_t reach() const noexcept
+    {
+        return m_reach;
+    }
+
+    [[nodiscard]] const std::pmr::string &output() const noexcept
+    {
+        return m_output;
+    }
+
+    [[nodiscard]] Cell cell(std::size_t index) const noexcept
+    {
+        return index < m_cells.size() ? m_cells[index] : Cell{0};
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_cells.size();
+    }
+
+private:
+    // the cell at the pointer plus offset, null off either end of the tape
+    [[nodiscard]] Cell *touch(std::int64_t offset)
+    {
+        const std::int64_t index = m_ptr + offset;
+        if (index < 0 || index >= BFPrefix::MAX_CELLS)
+            return nullptr;
+
+        const auto i = static_cast<std::size_t>(index);
+        if (i >= m_cells.size())
+        {
+            m_cells.resize(i + 1);
+            m_journaled.resize(i + 1);
+        }
+
+        if (m_journaled[i] != m_stop + 1)
+        {
+            m_journaled[i] = m_stop + 1;
+            m_journal.emplace_back(i, m_cells[i]);
+        }
+
+        m_reach = std::max(m_reach, index + 1);
+        return &m_cells[i];
+    }
+
+    [[nodiscard]] bool move(std::int64_t cells) noexcept
+    {
+        m_ptr += cells;
+        return m_ptr >= -BFPrefix::MAX_CELLS && m_ptr <= BFPrefix::MAX_CELLS;
+    }
+
+    // the ops from begin to end, false where they can't finish
+    [[nodiscard]] bool execute(std::size_t begin, std::size_t end)
+    {
+        for (std::size_t pc = begin; pc <= end; ++pc)
+        {
+            if (m_steps == 0)
+                return false;
+            --m_steps;
+
+            const BFOp &op = m_program.ops[pc];
+            Cell *cell = nullptr;
+
+            switch (op.code)
+            {
+            case BFOpCode::ADD:
+                if (!(cell = touch(op.offset)))
+                    return false;
+                *cell = static_cast<Cell>(*cell + static_cast<Cell>(op.arg));
+                break;
+
+            case BFOpCode::SET:
+                if (!(cell = touch(op.offset)))
+                    return false;
+                *cell = static_cast<Cell>(op.arg);
+                break;
+
+            case BFOpCode::MOVE:
+                if (!move(op.arg))
+                    return false;
+                break;
+
+            case BFOpCode::OUT:
+                if (!(cell = touch(op.offset)))
+                    return false;
+                m_output.push_back(static_cast<char>(static_cast<unsigned char>(*cell)));
+                break;
+
+            case BFOpCode::LOOP_BEGIN:
+                if (!(cell = touch(0)))
+                    return false;
+                if (*cell == 0)
+                    pc = op.jump;
+                break;
+
+            case BFOpCode::LOOP_END:
+                if (!(cell = touch(0)))
+                    return false;
+                if (*cell)
+                    pc = op.jump;
+                break;
+
+            case BFOpCode::SCAN:
+                for (;;)
+                {
+                    if (!(cell = touch(0)))
+                        return false;
+                    if (*cell == 0)
+                        break;
+                    if (m_steps == 0 || !move(op.arg))
+                        return false;
+                    --m_steps;
+                }
+                break;
+
+            // the source is read first, growing the tape for the target may
+            // move it; a source of 0 leaves the target alone
+            case BFOpCode::MUL_ADD:
+            {
+                if (!(cell = touch(op.src)))
+                    return false;
+                if (*cell == 0)
+                    break;
+                const auto product = static_cast<std::uint32_t>(*cell) * static_cast<std::uint32_t>(op.arg);
+                if (!(cell = touch(op.offset)))
+                    return false;
+                *cell = static_cast<Cell>(*cell + product);
+                break;
+            }
+
+            case BFOpCode::ADD_VEC:
+                if (op.arg > 0 && !touch(std::int64_t{op.offset} + op.arg - 1))
+                    return false;
+                for (std::int32_t k = 0; k < op.arg; ++k)
+                {
+                    if (!(cell = touch(std::int64_t{op.offset} + k)))
+                        return false;
+                    *cell = static_cast<Cell>(*cell + static_cast<Cell>(
+                                                          m_program.deltas[static_cast<std::size_t>(op.src + k)]));
+                }
+                break;
+
+            case BFOpCode::IN:
+            case BFOpCode::END:
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+// Partial evaluation of the start of a program that reads no input: runs
+// it, up to `steps` ops, and replaces the ops it ran by the state they
+// leave (see BFPrefix), so every run starts from there. The start is run
+// at each cell width and only cut off where they all agree on the state,
+// so the prefix holds for any width; where they part the program is left
+// as it is. Programs that already have a prefix are left alone.
+inline void evaluate_prefix(BFProgram &program, std::uint64_t steps,
+                            std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+{
+    if (program.prefix || steps == 0)
+        return;
+
+    BFPrefixEvaluator<std::uint8_t> narrow{program, steps, scratch};
+    BFPrefixEvaluator<std::uint16_t> middle{program, steps, scratch};
+    BFPrefixEvaluator<std::uint32_t> wide{program, steps, scratch};
+
+    // each one reaches the stop of the one before, with steps to spare
+    std::size_t stop = narrow.run();
+    stop = middle.run(stop);
+    stop = wide.run(stop);
+    if (stop == 0)
+        return;
+
+    if (narrow.stop() != stop)
+    {
+        narrow = BFPrefixEvaluator<std::uint8_t>{program, steps, scratch};
+        narrow.run(stop);
+    }
+    if (middle.stop() != stop)
+    {
+        middle = BFPrefixEvaluator<std::uint16_t>{program, steps, scratch};
+        middle.run(stop);
+    }
+
+    const auto agree = [&](const auto &other)
+    {
+        if (other.pointer() != wide.pointer() || other.reach() != wide.reach() || other.output() != wide.output())
+            return false;
+
+        using Cell = decltype(other.cell(0));
+        for (std::size_t i = 0; i < std::max(other.size(), wide.size()); ++i)
+            if (other.cell(i) != static_cast<Cell>(wide.cell(i)))
+                return false;
+        return true;
+    };
+
+    if (!agree(narrow) || !agree(middle))
+        return;
+
+    BFPrefix prefix;
+    prefix.pointer = wide.pointer();
+    prefix.reach = wide.reach();
+    prefix.output.assign(wide.output().begin(), wide.output().end());
+
+    std::size_t first = 0, last = wide.size();
+    while (first < last && wide.cell(first) == 0)
+        ++first;
+    while (last > first && wide.cell(last - 1) == 0)
+        --last;
+
+    prefix.first = static_cast<std::int64_t>(first);
+    for (std::size_t i = first; i < last; ++i)
+        prefix.cells.push_back(static_cast<std::int32_t>(wide.cell(i)));
+
+    program.ops.erase(program.ops.begin(), program.ops.begin() + static_cast<std::ptrdiff_t>(stop));
+    for (BFOp &op : program.ops)
+        if (op.code == BFOpCode::LOOP_BEGIN || op.code == BFOpCode::LOOP_END)
+            op.jump -= static_cast<std::uint32_t>(stop);
+
+    program.prefix = std::move(prefix);
+}
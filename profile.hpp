@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ir.hpp"
+
+// What the profiling engine records: how often every op ran and how long
+// every loop ran for, from entering it to falling out of it, nested loops
+// included. Loops are keyed by the index of their LOOP_BEGIN and reported
+// by its source position.
+class BFProfiler
+{
+public:
+    static constexpr std::size_t REPORT_LINES = 25;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<std::uint64_t> m_counts;
+    std::vector<Clock::duration> m_loop_time;
+    std::vector<std::pair<std::size_t, Clock::time_point>> m_open_loops;
+    Clock::duration m_total{};
+
+public:
+    BFProfiler() = default;
+
+    explicit BFProfiler(std::size_t ops)
+        : m_counts(ops), m_loop_time(ops)
+    {
+    }
+
+    void count(std::size_t op) noexcept
+    {
+        ++m_counts[op];
+    }
+
+    void enter_loop(std::size_t begin)
+    {
+        m_open_loops.emplace_back(begin, Clock::now());
+    }
+
+    void leave_loop()
+    {
+        const auto [begin, start] = m_open_loops.back();
+        m_open_loops.pop_back();
+        m_loop_time[begin] += Clock::now() - start;
+    }
+
+    void set_total(Clock::duration total) noexcept
+    {
+        m_total = total;
+    }
+
+    // the hottest ops by executions and the hottest loops by time
+    void report(std::ostream &out, BFProgramView program) const
+    {
+        std::uint64_t executed = 0;
+        for (const std::uint64_t count : m_counts)
+            executed += count;
+
+        out << "profile: " << executed << " ops executed in " << seconds(m_total) << "s\n\n"
+            << "hottest ops\n"
+            << "      executions   share  line:col  op\n";
+
+        std::vector<std::size_t> ops;
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+            if (m_counts[i])
+                ops.push_back(i);
+
+        std::ranges::stable_sort(ops, [&](std::size_t a, std::size_t b) { return m_counts[a] > m_counts[b]; });
+        ops.resize(std::min(ops.size(), REPORT_LINES));
+
+        for (const std::size_t i : ops)
+        {
+            out << std::setw(16) << m_counts[i] << "  " << share(m_counts[i], executed) << "  "
+                << location(program.ops[i]) << "  ";
+            dump_op(out, program, program.ops[i]);
+            out << '\n';
+        }
+
+        out << "\nhottest loops\n"
+            << "         seconds   share  line:col       entered    iterations\n";
+
+        std::vector<std::size_t> loops;
+        for (std::size_t i = 0; i < m_counts.size(); ++i)
+            if (program.ops[i].code == BFOpCode::LOOP_BEGIN && m_counts[i])
+                loops.push_back(i);
+
+        std::ranges::stable_sort(loops, [&](std::size_t a, std::size_t b) { return m_loop_time[a] > m_loop_time[b]; });
+        loops.resize(std::min(loops.size(), REPORT_LINES));
+
+        for (const std::size_t i : loops)
+        {
+            const auto time = static_cast<std::uint64_t>(m_loop_time[i].count());
+            const auto total = static_cast<std::uint64_t>(m_total.count());
+            out << std::setw(16) << seconds(m_loop_time[i]) << "  " << share(time, total) << "  "
+                << location(program.ops[i]) << std::setw(14) << m_counts[i] << std::setw(14)
+                << m_counts[program.ops[i].jump] << '\n';
+        }
+    }
+
+    // Folded stacks, one line per loop nest with the ops executed directly
+    // in it as the weight, e.g. "program;[3:1;[4:5 1200". Feeds
+    // flamegraph.pl and speedscope.
+    void write_folded(std::ostream &out, BFProgramView program) const
+    {
+        std::map<std::string, std::uint64_t> stacks;
+        std::vector<std::string> frames{"program"};
+
+        for (std::size_t i = 0; i < program.ops.size(); ++i)
+        {
+            const BFOp &op = program.ops[i];
+
+            // a loop's LOOP_BEGIN runs in the enclosing nest, its LOOP_END inside it
+            if (m_counts[i])
+                stacks[frames.back()] += m_counts[i];
+
+            if (op.code == BFOpCode::LOOP_BEGIN)
+                frames.push_back(frames.back() + ";[" + std::to_string(op.loc.line) + ':' +
+                                 std::to_string(op.loc.column));
+            else if (op.code == BFOpCode::LOOP_END)
+                frames.pop_back();
+        }
+
+        for (const auto &[stack, count] : stacks)
+            out << stack << ' ' << count << '\n';
+    }
+
+private:
+    [[nodiscard]] static std::string seconds(Clock::duration duration)
+    {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(6) << std::chrono::duration<double>(duration).count();
+        return text.str();
+    }
+
+    [[nodiscard]] static std::string share(std::uint64_t part, std::uint64_t total)
+    {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << std::setw(5)
+             << (total ? 100.0 * static_cast<double>(part) / static_cast<double>(total) : 0.0) << '%';
+        return text.str();
+    }
+
+    [[nodiscard]] static std::string location(const BFOp &op)
+    {
+        std::ostringstream text;
+        text << std::left << std::setw(8) << (std::to_string(op.loc.line) + ':' + std::to_string(op.loc.column));
+        return text.str();
+    }
+};
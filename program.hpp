@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "bounds.hpp"
+#include "bytecode.hpp"
+#include "cache.hpp"
+#include "ir.hpp"
+#include "jit.hpp"
+#include "loader.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "stats.hpp"
+
+enum class BFErrorCode
+{
+    IO,             // a file could not be read or written
+    SYNTAX,         // an unmatched bracket
+    BYTECODE,       // not a usable bytecode file
+    TAPE,           // the tape could not be reserved
+    TAPE_UNDERFLOW, // the program moved below the first cell
+    TAPE_OVERFLOW,  // the program moved past the last cell
+    LIMIT,          // the program ran into its step or time limit
+    SNAPSHOT        // a snapshot that can't be taken or doesn't fit the execution
+};
+
+// what the library returns instead of exiting, message is a complete
+// line as the command line tool prints it
+struct BFError
+{
+    BFErrorCode code;
+    std::string message;
+};
+
+struct BFCompileOptions
+{
+    BFOptimizeOptions optimize{};
+    std::string cache_dir; // compiled program cache, empty for none
+};
+
+// A parsed and optimized program, immutable once created, so one instance
+// can be shared by any number of executions on any number of threads
+// (see BFExecution). Holds either the IR or the mapped bytecode file it
+// runs from, and the bounds checks, the weights of --stats and of the step
+// budget and the machine code of each cell width, made on first use. Each
+// of those compilations takes its scratch memory from the arena of the
+// thread it runs on, see BFArena.
+class BFCompiledProgram
+{
+public:
+    using Pointer = std::shared_ptr<const BFCompiledProgram>;
+
+private:
+    BFProgram m_program;
+    std::optional<BFBytecode> m_bytecode;
+    BFProgramView m_code; // over m_program or m_bytecode
+
+    std::string m_cache_dir;
+    std::optional<std::uint64_t> m_cache_key; // set when the program cache is on
+
+    mutable std::once_flag m_analyzed;
+    mutable BFBounds m_bounds;
+    mutable std::once_flag m_weighed;
+    mutable BFWeights m_weights;
+
+#if BF_HAS_JIT
+    // one per BFJitMode, plain and preemptible
+    template <typename Cell>
+    struct JitSlot
+    {
+        std::once_flag compiled[4][2];
+        std::optional<BFJitCode<Cell>> code[4][2];
+    };
+
+    mutable std::tuple<JitSlot<std::uint8_t>, JitSlot<std::uint16_t>, JitSlot<std::uint32_t>> m_jit;
+#endif
+
+    BFCompiledProgram() = default;
+
+public:
+    BFCompiledProgram(const BFCompiledProgram &) = delete;
+    BFCompiledProgram &operator=(const BFCompiledProgram &) = delete;
+
+    // source text from memory, name is what errors report it as
+    [[nodiscard]] static std::expected<Pointer, BFError> from_source(std::string_view source,
+                                                                     const BFOptimizeOptions &options = {},
+                                                                     std::string_view name = "<memory>")
+    {
+        std::shared_ptr<BFCompiledProgram> program{new BFCompiledProgram};
+
+        BFParser parser;
+        parser.feed(source);
+        if (auto error = program->finish(parser, options, name))
+            return std::unexpected{std::move(*error)};
+
+        return program;
+    }
+
+    // IR straight from a BFParser, optimized here
+    [[nodiscard]] static Pointer from_ir(BFProgram ir, const BFOptimizeOptions &options = {})
+    {
+        std::shared_ptr<BFCompiledProgram> program{new BFCompiledProgram};
+        program->m_program = std::move(ir);
+        BFArenaScope arena;
+        BFOptimizer{options, arena.resource()}.optimize(program->m_program);
+        program->m_code = program->m_program;
+        return program;
+    }
+
+    // a source file, taken from the program cache when options name one
+    [[nodiscard]] static std::expected<Pointer, BFError> from_file(const std::string &path,
+                                                                   const BFCompileOptions &options = {})
+    {
+        std::error_code error;
+        if (!std::filesystem::exists(path, error))
+            return std::unexpected{BFError{BFErrorCode::IO, "Invalid input file."}};
+
+        std::shared_ptr<BFCompiledProgram> program{new BFCompiledProgram};
+        if (options.cache_dir.empty())
+        {
+            if (auto failure = program->parse_file(path, options.optimize))
+                return std::unexpected{std::move(*failure)};
+        }
+        else if (auto failure = program->load_cached(path, options))
+            return std::unexpected{std::move(*failure)};
+
+        program->m_code = program->m_program;
+        return program;
+    }
+
+    // a file written by --compile, run from its mapping
+    [[nodiscard]] static std::expected<Pointer, BFError> from_bytecode(const std::string &path)
+    {
+        std::error_code error;
+        if (!std::filesystem::exists(path, error))
+            return std::unexpected{BFError{BFErrorCode::IO, "Invalid input file."}};
+
+        auto bytecode = BFBytecode::open(path);
+        if (!bytecode)
+            return std::unexpected{BFError{BFErrorCode::BYTECODE, path + ": " + to_string(bytecode.error())}};
+
+        std::shared_ptr<BFCompiledProgram> program{new BFCompiledProgram};
+        program->m_bytecode = std::move(*bytecode);
+        program->m_code = program->m_bytecode->program();
+        return program;
+    }
+
+    [[nodiscard]] BFProgramView code() const noexcept
+    {
+        return m_code;
+    }
+
+    // "name:line:col: unmatched '['"
+    [[nodiscard]] static BFError syntax_error(const BFSyntaxError &error, std::string_view name)
+    {
+        return BFError{BFErrorCode::SYNTAX, std::string{name} + ':' + std::to_string(error.loc.line) + ':' +
+                                                std::to_string(error.loc.column) + ": unmatched '" + error.bracket +
+                                                "'"};
+    }
+
+    // the checks of --check-bounds, safe to call from any thread
+    [[nodiscard]] const BFBounds &bounds() const
+    {
+        std::call_once(m_analyzed,
+                       [&]
+                       {
+                           BFArenaScope arena;
+                           m_bounds = analyze_bounds(m_code, arena.resource());
+                       });
+        return m_bounds;
+    }
+
+    // what --stats counts and the step budget charges a block at a time,
+    // safe to call from any thread
+    [[nodiscard]] const BFWeights &weights() const
+    {
+        std::call_once(m_weighed,
+                       [&]
+                       {
+                           BFArenaScope arena;
+                           m_weights = analyze_weights(m_code, arena.resource());
+                       });
+        return m_weights;
+    }
+
+#if BF_HAS_JIT
+    // null where no machine code could be made, safe to call from any
+    // thread; preemptible code charges the weights of its loops to a step
+    // budget, see BFJitCallbacks
+    template <typename Cell>
+    [[nodiscard]] const BFJitCode<Cell> *jit(BFJitMode mode = BFJitMode::PLAIN, bool preemptible = false) const
+    {
+        JitSlot<Cell> &slot = std::get<JitSlot<Cell>>(m_jit);
+        const auto i = static_cast<std::size_t>(mode);
+        std::optional<BFJitCode<Cell>> &code = slot.code[i][preemptible];
+        std::call_once(slot.compiled[i][preemptible], [&] { code = compile_jit<Cell>(mode, preemptible); });
+        return code ? &*code : nullptr;
+    }
+#endif
+
+private:
+    [[nodiscard]] std::optional<BFError> finish(BFParser &parser, const BFOptimizeOptions &options,
+                                                std::string_view name)
+    {
+        auto program = parser.finish();
+        if (!program)
+            return syntax_error(program.error(), name);
+
+        m_program = std::move(*program);
+        BFArenaScope arena;
+        BFOptimizer{options, arena.resource()}.optimize(m_program);
+        m_code = m_program;
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<BFError> parse_file(const std::string &path, const BFOptimizeOptions &options)
+    {
+        BFParser parser;
+        if (!BFSourceLoader::load(path, parser))
+            return BFError{BFErrorCode::IO, "Could not read input file."};
+
+        return finish(parser, options, path);
+    }
+
+    // takes the program from the cache on a hit, parses and stores it on a
+    // miss; only the hash of the source is computed either way
+    [[nodiscard]] std::optional<BFError> load_cached(const std::string &path, const BFCompileOptions &options)
+    {
+        BFHasher hasher;
+        if (!BFSourceLoader::load(path, [&](std::string_view chunk) { hasher.update(chunk); }))
+            return BFError{BFErrorCode::IO, "Could not read input file."};
+
+        m_cache_dir = options.cache_dir;
+        m_cache_key = BFProgramCache::key(hasher.digest(), options.optimize);
+
+        const BFProgramCache cache{m_cache_dir};
+        if (auto program = cache.load(*m_cache_key))
+        {
+            m_program = std::move(*program);
+            return std::nullopt;
+        }
+
+        if (auto error = parse_file(path, options.optimize))
+            return error;
+
+        cache.store(*m_cache_key, m_program);
+        return std::nullopt;
+    }
+
+#if BF_HAS_JIT
+    // from the program cache where possible, stored there otherwise
+    template <typename Cell>
+    [[nodiscard]] std::optional<BFJitCode<Cell>> compile_jit(BFJitMode mode, bool preemptible) const
+    {
+        const bool stats = mode == BFJitMode::STATS || mode == BFJitMode::CHECKED_STATS;
+        const bool checked = mode != BFJitMode::STATS;
+        const BFBounds *const bounds = mode != BFJitMode::PLAIN ? &this->bounds() : nullptr;
+        const BFWeights *const weights = stats ? &this->weights() : nullptr;
+        const BFWeights *const charges = preemptible ? &this->weights() : nullptr;
+        BFArenaScope arena;
+        if (!m_cache_key)
+            return BFJitCode<Cell>::compile(m_code, bounds, weights, charges, checked, arena.resource());
+
+        const BFProgramCache cache{m_cache_dir};
+        constexpr int CELL_BITS = 8 * sizeof(Cell);
+        if (const auto cached = cache.load_code(*m_cache_key, CELL_BITS, mode, preemptible))
+            return BFJitCode<Cell>::load(*cached);
+
+        const auto code = BFJitCode<Cell>::assemble(m_code, bounds, weights, charges, checked, arena.resource());
+        if (!code)
+            return std::nullopt;
+
+        cache.store_code(*m_cache_key, CELL_BITS, mode, preemptible, *code);
+        return BFJitCode<Cell>::load(*code);
+    }
+#endif
+};
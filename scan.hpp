@@ -0,0 +1,213 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "tape.hpp"
+
+// the vector kernels rely on the guard regions to stop a search that runs
+// off the tape, see BFScanner
+#if defined(__x86_64__) && defined(__GNUC__) && BF_HAS_GUARD_PAGES
+#define BF_HAS_SIMD_SCAN 1
+#include <immintrin.h>
+#else
+#define BF_HAS_SIMD_SCAN 0
+#endif
+
+#if BF_HAS_SIMD_SCAN
+// Zero tests of one aligned block of cells. Bit i of the mask is set when
+// byte i belongs to a cell that is zero; wider cells set all their bits.
+template <typename Cell>
+struct BFScanSse2
+{
+    static constexpr std::size_t SIZE = 16;
+
+    [[nodiscard]] static std::uint32_t zeros(std::uintptr_t block) noexcept
+    {
+        const __m128i cells = _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+        const __m128i zero = _mm_setzero_si128();
+
+        __m128i equal;
+        if constexpr (sizeof(Cell) == 1)
+            equal = _mm_cmpeq_epi8(cells, zero);
+        else if constexpr (sizeof(Cell) == 2)
+            equal = _mm_cmpeq_epi16(cells, zero);
+        else
+            equal = _mm_cmpeq_epi32(cells, zero);
+
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(equal));
+    }
+};
+
+template <typename Cell>
+struct BFScanAvx2
+{
+    static constexpr std::size_t SIZE = 32;
+
+    [[nodiscard, gnu::target("avx2")]] static std::uint32_t zeros(std::uintptr_t block) noexcept
+    {
+        const __m256i cells = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+        const __m256i zero = _mm256_setzero_si256();
+
+        __m256i equal;
+        if constexpr (sizeof(Cell) == 1)
+            equal = _mm256_cmpeq_epi8(cells, zero);
+        else if constexpr (sizeof(Cell) == 2)
+            equal = _mm256_cmpeq_epi16(cells, zero);
+        else
+            equal = _mm256_cmpeq_epi32(cells, zero);
+
+        return static_cast<std::uint32_t>(_mm256_movemask_epi8(equal));
+    }
+};
+#endif
+
+// Runs SCAN, the first zero cell at ptr, ptr + stride, ptr + 2 * stride...
+// Stride 1 of byte cells goes to memchr()/memrchr(). Strides whose step
+// in bytes is a power of two up to the vector size test a whole aligned
+// block of cells per compare, picked at runtime between AVX2 and SSE2.
+// Anything else takes the scalar loop.
+//
+// Aligned vector loads never cross a page, and the tape is whole pages,
+// so a block is either all cells or all guard region. Loads only reach
+// the guard once every candidate cell up to the end of the tape was
+// nonzero, which is exactly where the scalar loop would have faulted.
+// Without guard regions the scalar loop stops at either end of the tape
+// on its own, and returns the pointer off the tape for the bounds check
+// after the scan to report.
+template <typename Cell>
+class BFScanner
+{
+private:
+    Cell *m_begin;
+    Cell *m_end;
+    bool m_avx2 = false;
+
+public:
+    BFScanner(Cell *cells, std::size_t count) noexcept
+        : m_begin{cells}, m_end{cells + count}
+    {
+#if BF_HAS_SIMD_SCAN
+        __builtin_cpu_init();
+        m_avx2 = __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    [[nodiscard]] Cell *find_zero(Cell *ptr, std::int32_t stride) const noexcept
+    {
+        // short scans are the common case, and a pointer that is already off
+        // the tape faults here just like in the scalar loop
+        if (*ptr == 0)
+            return ptr;
+
+        if (ptr >= m_begin && ptr < m_end)
+        {
+            if constexpr (sizeof(Cell) == 1)
+            {
+                if (stride == 1)
+                {
+                    void *found = std::memchr(ptr, 0, static_cast<std::size_t>(m_end - ptr));
+                    if (found)
+                        return static_cast<Cell *>(found);
+                    return scalar(m_end, stride);
+                }
+#if defined(__GLIBC__)
+                if (stride == -1)
+                {
+                    void *found = memrchr(m_begin, 0, static_cast<std::size_t>(ptr - m_begin));
+                    if (found)
+                        return static_cast<Cell *>(found);
+                    return scalar(m_begin - 1, stride);
+                }
+#endif
+            }
+
+#if BF_HAS_SIMD_SCAN
+            const std::size_t step = static_cast<std::size_t>(stride < 0 ? -stride : stride) * sizeof(Cell);
+            if (std::has_single_bit(step))
+            {
+                if (m_avx2 && step <= BFScanAvx2<Cell>::SIZE)
+                    return stride > 0 ? forward_avx2(ptr, step) : backward_avx2(ptr, step);
+                if (step <= BFScanSse2<Cell>::SIZE)
+                    return stride > 0 ? forward<BFScanSse2<Cell>>(ptr, step) : backward<BFScanSse2<Cell>>(ptr, step);
+            }
+#endif
+        }
+
+        return scalar(ptr, stride);
+    }
+
+private:
+    [[nodiscard]] Cell *scalar(Cell *ptr, std::int32_t stride) const noexcept
+    {
+#if BF_HAS_GUARD_PAGES
+        while (*ptr)
+            ptr += stride;
+#else
+        while (ptr >= m_begin && ptr < m_end && *ptr)
+            ptr += stride;
+#endif
+        return ptr;
+    }
+
+#if BF_HAS_SIMD_SCAN
+    // the bytes of a block that start a candidate cell, every step bytes
+    // from wherever ptr sits
+    [[nodiscard]] static std::uint32_t candidates(std::uintptr_t address, std::size_t step, std::size_t size) noexcept
+    {
+        std::uint32_t pattern = 0;
+        for (std::size_t i = address % step; i < size; i += step)
+            pattern |= 1u << i;
+        return pattern;
+    }
+
+    template <typename Vector>
+    [[nodiscard]] static Cell *forward(Cell *ptr, std::size_t step) noexcept
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+        const std::uint32_t pattern = candidates(address, step, Vector::SIZE);
+
+        // the first block also holds cells before ptr, mask them out
+        std::uintptr_t block = address & ~(Vector::SIZE - 1);
+        std::uint32_t found = Vector::zeros(block) & pattern & (~0u << (address - block));
+        while (!found)
+        {
+            block += Vector::SIZE;
+            found = Vector::zeros(block) & pattern;
+        }
+
+        return reinterpret_cast<Cell *>(block + static_cast<std::uintptr_t>(std::countr_zero(found)));
+    }
+
+    template <typename Vector>
+    [[nodiscard]] static Cell *backward(Cell *ptr, std::size_t step) noexcept
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(ptr);
+        const std::uint32_t pattern = candidates(address, step, Vector::SIZE);
+
+        // the first block also holds cells after ptr, mask them out
+        std::uintptr_t block = address & ~(Vector::SIZE - 1);
+        std::uint32_t found = Vector::zeros(block) & pattern & ((2u << (address - block)) - 1);
+        while (!found)
+        {
+            block -= Vector::SIZE;
+            found = Vector::zeros(block) & pattern;
+        }
+
+        return reinterpret_cast<Cell *>(block + static_cast<std::uintptr_t>(31 - std::countl_zero(found)));
+    }
+
+    // flattened so the AVX2 compares are inlined into code built for AVX2
+    [[nodiscard, gnu::target("avx2"), gnu::flatten]] static Cell *forward_avx2(Cell *ptr, std::size_t step) noexcept
+    {
+        return forward<BFScanAvx2<Cell>>(ptr, step);
+    }
+
+    [[nodiscard, gnu::target("avx2"), gnu::flatten]] static Cell *backward_avx2(Cell *ptr, std::size_t step) noexcept
+    {
+        return backward<BFScanAvx2<Cell>>(ptr, step);
+    }
+#endif
+};
@@ -0,0 +1,441 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "execution.hpp"
+#include "program.hpp"
+
+#if defined(__linux__)
+#define BF_HAS_REACTOR 1
+#include <cerrno>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#else
+#define BF_HAS_REACTOR 0
+#endif
+
+struct BFServeOptions
+{
+    std::uint16_t port = 0;
+    std::size_t threads = 0;                      // reactors, 0 for one per hardware thread
+    std::uint64_t slice = std::uint64_t{1} << 20; // ops a session runs before the next one's turn
+};
+
+#if BF_HAS_REACTOR
+
+// A coroutine started by BFReactor::spawn() and owned by the reactor from
+// then on; its frame is freed when it returns. Until spawned the task owns
+// the frame, which hasn't started running.
+class BFTask
+{
+public:
+    struct promise_type
+    {
+        std::size_t *live = nullptr; // the tasks of the reactor running it
+
+        struct Done
+        {
+            std::size_t *live;
+
+            // the frame goes once the task is off the books
+            bool await_ready() const noexcept
+            {
+                if (live)
+                    --*live;
+                return true;
+            }
+
+            void await_suspend(std::coroutine_handle<>) const noexcept
+            {
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        BFTask get_return_object() noexcept
+        {
+            return BFTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        Done final_suspend() const noexcept
+        {
+            return Done{live};
+        }
+
+        void return_void() const noexcept
+        {
+        }
+
+        // sessions report their errors themselves, anything else is a bug
+        void unhandled_exception() const noexcept
+        {
+            std::terminate();
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+
+    explicit BFTask(std::coroutine_handle<promise_type> handle) noexcept : m_handle{handle}
+    {
+    }
+
+public:
+    BFTask(BFTask &&other) noexcept : m_handle{std::exchange(other.m_handle, {})}
+    {
+    }
+
+    BFTask &operator=(BFTask &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_handle)
+                m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, {});
+        }
+        return *this;
+    }
+
+    ~BFTask()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    [[nodiscard]] std::coroutine_handle<promise_type> release() noexcept
+    {
+        return std::exchange(m_handle, {});
+    }
+};
+
+// A single-threaded event loop over epoll. Tasks co_await readable(),
+// writable() and yield() instead of blocking. Each round the reactor takes
+// what epoll reports, without waiting while tasks are ready, and resumes
+// every task ready by then in order; tasks that yield meanwhile go to the
+// next round. Watches are one-shot, so a descriptor is waited for by one
+// task at a time. A reactor runs on the thread that calls run(), several
+// reactors on several threads share nothing.
+class BFReactor
+{
+private:
+    int m_epoll;
+    std::deque<std::coroutine_handle<>> m_ready;
+    std::size_t m_live = 0;
+
+    struct Wait
+    {
+        BFReactor &reactor;
+        int fd;
+        std::uint32_t events;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        // where the descriptor can't be watched the task goes on at once,
+        // and finds out from its next read or write
+        bool await_suspend(std::coroutine_handle<> task) const noexcept
+        {
+            return reactor.watch(fd, events, task);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    struct Yield
+    {
+        BFReactor &reactor;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> task) const
+        {
+            reactor.m_ready.push_back(task);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+public:
+    static constexpr std::size_t EVENTS = 256; // taken from epoll per wait
+
+    BFReactor() : m_epoll{::epoll_create1(EPOLL_CLOEXEC)}
+    {
+    }
+
+    BFReactor(const BFReactor &) = delete;
+    BFReactor &operator=(const BFReactor &) = delete;
+
+    // tasks still not done are dropped without being resumed again
+    ~BFReactor()
+    {
+        if (m_epoll >= 0)
+            ::close(m_epoll);
+    }
+
+    // false when no epoll instance could be made
+    [[nodiscard]] bool valid() const noexcept
+    {
+        return m_epoll >= 0;
+    }
+
+    // the task runs from the next round on
+    void spawn(BFTask task)
+    {
+        const auto handle = task.release();
+        handle.promise().live = &m_live;
+        ++m_live;
+        m_ready.push_back(handle);
+    }
+
+    [[nodiscard]] Wait readable(int fd) noexcept
+    {
+        return Wait{*this, fd, EPOLLIN | EPOLLRDHUP};
+    }
+
+    [[nodiscard]] Wait writable(int fd) noexcept
+    {
+        return Wait{*this, fd, EPOLLOUT};
+    }
+
+    // to the back of the queue, behind every task that is ready
+    [[nodiscard]] Yield yield() noexcept
+    {
+        return Yield{*this};
+    }
+
+    // runs until every task spawned has returned
+    void run()
+    {
+        std::array<epoll_event, EVENTS> events;
+        while (m_live > 0)
+        {
+            const int count = ::epoll_wait(m_epoll, events.data(), static_cast<int>(events.size()),
+                                           m_ready.empty() ? -1 : 0);
+            for (int i = 0; i < count; ++i)
+                m_ready.push_back(std::coroutine_handle<>::from_address(events[static_cast<std::size_t>(i)].data.ptr));
+
+            // tasks that yield now go after those that woke up meanwhile
+            for (std::size_t round = m_ready.size(); round > 0; --round)
+            {
+                const auto task = m_ready.front();
+                m_ready.pop_front();
+                task.resume();
+            }
+        }
+    }
+
+private:
+    [[nodiscard]] bool watch(int fd, std::uint32_t events, std::coroutine_handle<> task) noexcept
+    {
+        epoll_event event{};
+        event.events = events | EPOLLONESHOT;
+        event.data.ptr = task.address();
+        if (::epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &event) == 0)
+            return true;
+
+        return errno == ENOENT && ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+};
+
+// Serves one connected, non-blocking socket: the program reads what the
+// peer sends with , and sends what it writes with . to the peer. The
+// execution runs in slices of `slice` ops and yields to the other tasks of
+// the reactor between them, and when , finds no input it waits for the
+// socket instead of blocking the thread. Output goes out after each slice,
+// and a slice waits for the peer to take it, so a peer that reads slowly
+// only slows its own session down. The end of what the peer sends is the
+// end of input.
+//
+// An error goes to the peer as the command line would print it, then the
+// socket is closed. Profiling options are ignored. A session idle on ,
+// holds its socket until the peer closes it; the limits are looked at
+// again once input arrives.
+template <typename Cell = std::uint8_t>
+BFTask run_session(BFReactor &reactor, BFCompiledProgram::Pointer program, BFRunOptions options, int fd,
+                   std::uint64_t slice = BFServeOptions{}.slice)
+{
+    options.profile = nullptr;
+    options.profile_folded.clear();
+    options.fed_input = true;
+
+    std::istringstream no_input;
+    std::ostringstream out;
+    const auto execution = BFExecution<Cell>::create(std::move(program), options, no_input, out);
+
+    // from sent on, false with errno set where the socket took less
+    const auto send = [fd](std::string_view data, std::size_t &sent)
+    {
+        while (sent < data.size())
+        {
+            const ssize_t wrote = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (wrote < 0)
+                return false;
+            sent += static_cast<std::size_t>(wrote);
+        }
+        return true;
+    };
+
+    for (bool open = true; open;)
+    {
+        std::string pending;
+        std::optional<BFRunState> state; // none once the session fails
+        if (!execution)
+            pending = execution.error().message + '\n';
+        else
+        {
+            BFBudget budget{.steps = slice};
+            const auto ran = (*execution)->run(budget);
+            pending = std::move(out).str();
+            out.str({});
+            if (ran)
+                state = *ran;
+            else
+                pending += ran.error().message + '\n';
+        }
+
+        for (std::size_t sent = 0; open && !send(pending, sent);)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                co_await reactor.writable(fd);
+            else
+                open = errno == EINTR;
+        }
+
+        if (!state || *state == BFRunState::FINISHED)
+            break;
+
+        if (*state == BFRunState::SUSPENDED)
+            co_await reactor.yield();
+
+        // BFRunState::INPUT, as much as the socket has
+        while (open && *state == BFRunState::INPUT)
+        {
+            const std::span<char> space = (*execution)->input_space();
+            const ssize_t got = ::recv(fd, space.data(), space.size(), 0);
+            if (got > 0)
+                (*execution)->commit_input(static_cast<std::size_t>(got));
+            else if (got == 0)
+                (*execution)->close_input();
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                co_await reactor.readable(fd);
+                continue;
+            }
+            else if (errno == EINTR)
+                continue;
+            else
+                open = false;
+            break;
+        }
+    }
+
+    ::close(fd);
+}
+
+// takes connections for run_session() until the listener fails for good
+template <typename Cell = std::uint8_t>
+BFTask accept_sessions(BFReactor &reactor, int listener, BFCompiledProgram::Pointer program, BFRunOptions options,
+                       std::uint64_t slice)
+{
+    for (;;)
+    {
+        const int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0)
+            reactor.spawn(run_session<Cell>(reactor, program, options, fd, slice));
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await reactor.readable(listener);
+        else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            // out of descriptors or memory, sessions that end free some
+            co_await reactor.yield();
+        else if (errno != EINTR && errno != ECONNABORTED && errno != EPROTO)
+            co_return;
+    }
+}
+
+// Listens on the port of serve on every interface and runs a session, see
+// run_session(), for each connection. Every thread runs a reactor of its
+// own that takes connections and keeps them, so a thread holds any number
+// of sessions. Returns only when the port can't be listened on.
+template <typename Cell = std::uint8_t>
+[[nodiscard]] std::expected<void, BFError> serve(const BFCompiledProgram::Pointer &program,
+                                                 const BFRunOptions &options, const BFServeOptions &serve)
+{
+    const BFError failed{BFErrorCode::IO, "Could not listen on port " + std::to_string(serve.port) + "."};
+
+    const int listener = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        return std::unexpected{failed};
+
+    const int reuse = 1;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(serve.port);
+    if (::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        ::bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, SOMAXCONN) != 0)
+    {
+        ::close(listener);
+        return std::unexpected{failed};
+    }
+
+    const std::size_t threads = serve.threads ? serve.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<BFReactor>> reactors;
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        auto reactor = std::make_unique<BFReactor>();
+        if (!reactor->valid())
+        {
+            ::close(listener);
+            return std::unexpected{BFError{BFErrorCode::IO, "Could not create an epoll instance."}};
+        }
+
+        reactor->spawn(accept_sessions<Cell>(*reactor, listener, program, options, serve.slice));
+        reactors.push_back(std::move(reactor));
+    }
+
+    {
+        std::vector<std::jthread> threads_running;
+        for (auto &reactor : reactors)
+            threads_running.emplace_back([&reactor] { reactor->run(); });
+    }
+
+    ::close(listener);
+    return std::unexpected{failed};
+}
+
+#endif
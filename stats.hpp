@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <ostream>
+#include <vector>
+
+#include "ir.hpp"
+
+// What --stats reports of the runs of an execution. The engines count ops
+// a block at a time (see analyze_weights()) and record the tape extent
+// where the checks of analyze_bounds() would be, checked or not. The I/O
+// buffers count bytes and time their reads and writes.
+struct BFStats
+{
+    std::uint64_t runs = 0;
+    std::uint64_t ops = 0; // IR ops executed
+    std::uint64_t loop_iterations = 0;
+    std::uint64_t input_bytes = 0; // read by ,
+    std::uint64_t output_bytes = 0;
+    std::chrono::nanoseconds run_time{};
+    std::chrono::nanoseconds io_time{}; // of run_time, waiting for input and writing output
+    std::int64_t tape_low = 0;          // the lowest cell touched
+    std::int64_t tape_high = -1;        // the highest, below tape_low when none was
+
+    [[nodiscard]] bool touched() const noexcept
+    {
+        return tape_low <= tape_high;
+    }
+
+    BFStats &operator+=(const BFStats &other) noexcept
+    {
+        runs += other.runs;
+        ops += other.ops;
+        loop_iterations += other.loop_iterations;
+        input_bytes += other.input_bytes;
+        output_bytes += other.output_bytes;
+        run_time += other.run_time;
+        io_time += other.io_time;
+
+        if (!touched())
+        {
+            tape_low = other.tape_low;
+            tape_high = other.tape_high;
+        }
+        else if (other.touched())
+        {
+            tape_low = std::min(tape_low, other.tape_low);
+            tape_high = std::max(tape_high, other.tape_high);
+        }
+        return *this;
+    }
+
+    // one JSON object, compute_seconds is run time outside I/O
+    void write_json(std::ostream &out) const
+    {
+        const auto seconds = [](std::chrono::nanoseconds time) { return std::chrono::duration<double>{time}.count(); };
+
+        out << "{\n  \"runs\": " << runs << ",\n  \"ops\": " << ops << ",\n  \"loop_iterations\": " << loop_iterations
+            << ",\n  \"input_bytes\": " << input_bytes << ",\n  \"output_bytes\": " << output_bytes
+            << ",\n  \"run_seconds\": " << seconds(run_time) << ",\n  \"io_seconds\": " << seconds(io_time)
+            << ",\n  \"compute_seconds\": " << seconds(std::max(run_time - io_time, std::chrono::nanoseconds{}))
+            << ",\n  \"tape_low\": ";
+        if (touched())
+            out << tape_low << ",\n  \"tape_high\": " << tape_high;
+        else
+            out << "null,\n  \"tape_high\": null";
+        out << "\n}\n";
+    }
+};
+
+// The counters the engines update while running, laid out for jitted code,
+// which addresses them through r13. The extent is kept as cell addresses.
+struct BFCounters
+{
+    std::uint64_t ops = 0;
+    std::uint64_t iterations = 0;
+    std::uintptr_t low = std::numeric_limits<std::uintptr_t>::max(); // the lowest cell touched
+    std::uintptr_t high = 0;                                          // one past the highest
+
+    // the cells from low to high - 1, as the checks that passed saw them
+    void extend(std::uintptr_t from, std::uintptr_t to) noexcept
+    {
+        low = std::min(low, from);
+        high = std::max(high, to);
+    }
+};
+
+static_assert(offsetof(BFCounters, ops) == 0 && offsetof(BFCounters, iterations) == 8 &&
+              offsetof(BFCounters, low) == 16 && offsetof(BFCounters, high) == 24);
+
+// ops are counted by the block, see analyze_weights()
+struct BFWeights
+{
+    std::uint64_t top = 0;            // ops at the top level, counted when a run starts
+    std::vector<std::uint32_t> loops; // per op, for a LOOP_BEGIN the ops of one iteration of its body
+};
+
+// Brainfuck has no early exits, so once a loop body starts an iteration
+// every op directly in it runs: nested LOOP_BEGINs included, their bodies
+// not, and the LOOP_END. The engines add that weight when an iteration
+// starts and the top level's when a run starts, which counts every op
+// executed in one addition per iteration. A run that faults is counted as
+// if its last block had finished.
+[[nodiscard]] inline BFWeights analyze_weights(BFProgramView program,
+                                               std::pmr::memory_resource *scratch = std::pmr::get_default_resource())
+{
+    BFWeights weights;
+    weights.loops.resize(program.ops.size());
+
+    std::pmr::vector<std::size_t> open{scratch};
+    for (std::size_t i = 0; i < program.ops.size(); ++i)
+    {
+        const BFOp &op = program.ops[i];
+        if (open.empty())
+            ++weights.top;
+        else
+            ++weights.loops[open.back()];
+
+        if (op.code == BFOpCode::LOOP_BEGIN)
+            open.push_back(i);
+        else if (op.code == BFOpCode::LOOP_END)
+            open.pop_back();
+    }
+
+    return weights;
+}
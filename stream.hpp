@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "execution.hpp"
+#include "loader.hpp"
+#include "parser.hpp"
+#include "program.hpp"
+
+// an execution without a program yet, for run_pieces()
+template <typename Cell = std::uint8_t>
+[[nodiscard]] std::expected<typename BFExecution<Cell>::Pointer, BFError> create_streamed(BFRunOptions options,
+                                                                                       std::istream &in,
+                                                                                       std::ostream &out)
+{
+    options.profile = nullptr;
+    options.profile_folded.clear();
+    return BFExecution<Cell>::create(BFCompiledProgram::from_ir(BFParser{}.finish().value()), options, in, out);
+}
+
+// What run_streamed() does with the source once it has an execution:
+// read(feed) hands every chunk to feed as it arrives and returns false
+// when reading failed, and errors name path. The pieces all run on the
+// execution, which keeps the tape and pointer the last one left.
+template <typename Cell, typename Read>
+[[nodiscard]] std::expected<void, BFError> run_pieces(BFExecution<Cell> &execution, BFOptimizeOptions optimize,
+                                                      Read &&read, const std::string &path)
+{
+    optimize.prefix_steps = 0;
+
+    BFParser parser;
+    std::optional<BFError> error;
+    const auto run = [&](BFProgram piece)
+    {
+        execution.set_program(BFCompiledProgram::from_ir(std::move(piece), optimize));
+        if (auto ran = execution.run(); !ran)
+            error = std::move(ran.error());
+    };
+
+    const bool read_all = read([&](std::string_view chunk)
+    {
+        if (error || parser.failed())
+            return;
+
+        parser.feed(chunk);
+        if (auto piece = parser.take_balanced())
+            run(std::move(*piece));
+    });
+
+    if (error)
+        return std::unexpected{std::move(*error)};
+    if (!read_all)
+        return std::unexpected{BFError{BFErrorCode::IO, "Could not read input file."}};
+
+    auto rest = parser.finish();
+    if (!rest)
+        return std::unexpected{BFCompiledProgram::syntax_error(rest.error(), path)};
+
+    run(std::move(*rest));
+    if (error)
+        return std::unexpected{std::move(*error)};
+
+    return {};
+}
+
+// Runs a program while it is still being read, from a pipe or "-" for
+// stdin. Whatever arrives is lexed at once, and the ops before the first
+// loop still open are optimized and run on the one execution and then
+// dropped. Memory stays bounded by the largest top-level loop rather than
+// by the program, and output starts with the first complete piece.
+//
+// Code before a syntax error has already run by the time the error is
+// found. Profiling options are ignored, and so is prefix evaluation, as
+// each piece would start over from a prefix of its own. The limits of the
+// options hold for all pieces together. stats, when given, receives what
+// all the pieces did, whether the run failed or not.
+template <typename Cell = std::uint8_t>
+[[nodiscard]] std::expected<void, BFError> run_streamed(const std::string &path, BFOptimizeOptions optimize,
+                                                        BFRunOptions options, std::istream &in = std::cin,
+                                                        std::ostream &out = std::cout, BFStats *stats = nullptr)
+{
+    auto execution = create_streamed<Cell>(options, in, out);
+    if (!execution)
+        return std::unexpected{std::move(execution.error())};
+
+    auto ran = run_pieces(**execution, optimize,
+                          [&](auto &&feed) { return BFSourceLoader::stream(path, feed); }, path);
+    if (stats)
+        *stats = (*execution)->stats();
+    return ran;
+}
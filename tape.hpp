@@ -0,0 +1,480 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <csetjmp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BF_HAS_GUARD_PAGES 1
+#include <csignal>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define BF_HAS_GUARD_PAGES 0
+#endif
+
+#if defined(__linux__)
+#define BF_HAS_SHARED_TAPES 1 // snapshots map their pages copy-on-write, see BFTape::restore()
+#else
+#define BF_HAS_SHARED_TAPES 0
+#endif
+
+#if BF_HAS_GUARD_PAGES
+// a live tape's mapping as seen by the fault handler
+struct BFTapeGuards
+{
+    std::atomic<std::uintptr_t> begin{0}; // start of the low guard
+    std::atomic<std::uintptr_t> cells{0};
+    std::atomic<std::uintptr_t> end{0}; // end of the high guard
+};
+
+// Slots for the guards of live tapes. Blocks are chained on as tapes
+// outgrow them and never freed, so the fault handler can walk them
+// without locking while another thread adds one.
+struct BFTapeGuardBlock
+{
+    static constexpr std::size_t SLOTS = 1024;
+
+    BFTapeGuards slots[SLOTS];
+    std::atomic<BFTapeGuardBlock *> next{nullptr};
+};
+#endif
+
+// how a guarded run ended, see BFTape::guarded() and BFTape::fault()
+enum class BFTapeFault
+{
+    NONE,
+    BELOW, // moved below the first cell
+    ABOVE  // moved past the last cell
+};
+
+// The cells of a tape at one point, see BFTape::snapshot(). Only pages
+// holding a nonzero cell are kept, so a snapshot costs what the tape
+// used rather than its size. It never changes, so any number of tapes on
+// any threads can be restored from one.
+class BFTapeSnapshot
+{
+private:
+    std::size_t m_size = 0;  // of the tape
+    std::size_t m_pages = 0; // kept
+    std::size_t m_page = 0;
+    std::size_t m_first = 0; // the kept pages lie in [m_first, m_end)
+    std::size_t m_end = 0;
+
+#if BF_HAS_SHARED_TAPES
+    int m_file = -1; // as large as the tape, with holes for the pages not kept
+#else
+    std::vector<std::size_t> m_offsets; // of the kept pages
+    std::vector<unsigned char> m_cells; // the kept pages, one after the other
+#endif
+
+    friend class BFTape;
+
+public:
+    BFTapeSnapshot() = default;
+    BFTapeSnapshot(const BFTapeSnapshot &) = delete;
+    BFTapeSnapshot &operator=(const BFTapeSnapshot &) = delete;
+
+    ~BFTapeSnapshot()
+    {
+#if BF_HAS_SHARED_TAPES
+        if (m_file >= 0)
+            close(m_file);
+#endif
+    }
+
+    // of the tape it was taken of, in bytes
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    // what it keeps of the tape, in bytes
+    [[nodiscard]] std::size_t kept() const noexcept
+    {
+        return m_pages * m_page;
+    }
+};
+
+// The tape lives in one large reserved mapping with inaccessible guard
+// regions on both sides. Pages are only backed by memory once touched,
+// so a big limit costs nothing until used, and moving off either end
+// faults in a guard region, which is reported as a clean error instead
+// of silently corrupting memory. The engines need no bounds checks, and
+// where there are no guard pages they check ranges instead (see
+// analyze_bounds()).
+//
+// A snapshot of a tape restores any number of others of the same size.
+// Where tapes are shared, the pages of the snapshot are mapped into them
+// copy-on-write, so restoring costs a mapping whatever the tape holds, and
+// a tape only gets memory of its own for the pages it writes to.
+class BFTape
+{
+public:
+    static constexpr std::size_t DEFAULT_SIZE = 30'000;
+    static constexpr std::size_t GUARD_SIZE = 1024 * 1024;
+    static constexpr std::size_t CLEAR_BY_UNMAPPING = 256 * 1024; // tapes clear() hands back to the kernel
+    static constexpr std::size_t SNAPSHOT_PAGE = 4096;            // where the pages aren't the system's
+
+private:
+    unsigned char *m_cells = nullptr;
+    std::size_t m_size = 0;
+
+#if BF_HAS_GUARD_PAGES
+    void *m_mapping = nullptr;
+    std::size_t m_mapping_size = 0;
+#endif
+#if BF_HAS_SHARED_TAPES
+    bool m_shared = false; // the cells map pages of a snapshot
+#endif
+#if !BF_HAS_GUARD_PAGES
+    std::unique_ptr<unsigned char[]> m_storage;
+#endif
+
+public:
+    // size in bytes, rounded up to whole pages where guard pages are used;
+    // throws std::bad_alloc when the range can't be reserved or its guards
+    // registered
+    explicit BFTape(std::size_t size = DEFAULT_SIZE)
+    {
+#if BF_HAS_GUARD_PAGES
+        const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const std::size_t guard = std::max(GUARD_SIZE, page);
+        m_size = (std::max<std::size_t>(size, 1) + page - 1) / page * page;
+        m_mapping_size = guard + m_size + guard;
+
+        m_mapping = mmap(nullptr, m_mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (m_mapping == MAP_FAILED)
+            throw std::bad_alloc{};
+
+        m_cells = static_cast<unsigned char *>(m_mapping) + guard;
+        if (mprotect(m_cells, m_size, PROT_READ | PROT_WRITE) != 0)
+        {
+            munmap(m_mapping, m_mapping_size);
+            throw std::bad_alloc{};
+        }
+
+        try
+        {
+            register_guards();
+        }
+        catch (...)
+        {
+            munmap(m_mapping, m_mapping_size);
+            throw;
+        }
+#else
+        m_size = std::max<std::size_t>(size, 1);
+        m_storage = std::make_unique<unsigned char[]>(m_size);
+        m_cells = m_storage.get();
+#endif
+    }
+
+    BFTape(const BFTape &) = delete;
+    BFTape &operator=(const BFTape &) = delete;
+
+    ~BFTape()
+    {
+#if BF_HAS_GUARD_PAGES
+        unregister_guards();
+        munmap(m_mapping, m_mapping_size);
+#endif
+    }
+
+    [[nodiscard]] unsigned char *data() const noexcept
+    {
+        return m_cells;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return m_size;
+    }
+
+    // zeroes every cell; large tapes drop their pages instead, which come
+    // back zeroed when touched, so only what a run used costs anything
+    void clear() noexcept
+    {
+#if BF_HAS_SHARED_TAPES
+        // dropping the pages of a snapshot would only read them back
+        if (m_shared && map_zeroed())
+            m_shared = false;
+        if (m_shared)
+        {
+            std::memset(m_cells, 0, m_size);
+            return;
+        }
+#endif
+#if BF_HAS_GUARD_PAGES
+        if (m_size >= CLEAR_BY_UNMAPPING && madvise(m_cells, m_size, MADV_DONTNEED) == 0)
+            return;
+#endif
+        std::memset(m_cells, 0, m_size);
+    }
+
+    // The cells as they are now, a page at a time; throws std::bad_alloc
+    // when there is no memory for them. Reads the whole tape, so it takes
+    // as long as clearing it would.
+    [[nodiscard]] std::shared_ptr<const BFTapeSnapshot> snapshot() const
+    {
+        auto snapshot = std::make_shared<BFTapeSnapshot>();
+        const std::size_t page = page_size();
+        snapshot->m_size = m_size;
+        snapshot->m_page = page;
+
+#if BF_HAS_SHARED_TAPES
+        snapshot->m_file = memfd_create("bf-tape", MFD_CLOEXEC);
+        if (snapshot->m_file < 0 || ftruncate(snapshot->m_file, static_cast<off_t>(m_size)) != 0)
+            throw std::bad_alloc{};
+#endif
+
+        for (std::size_t offset = 0; offset < m_size; offset += page)
+        {
+            const unsigned char *const cells = m_cells + offset;
+            const std::size_t length = std::min(page, m_size - offset);
+            if (cells[0] == 0 && std::memcmp(cells, cells + 1, length - 1) == 0)
+                continue;
+
+            if (snapshot->m_pages++ == 0)
+                snapshot->m_first = offset;
+            snapshot->m_end = offset + length;
+
+#if BF_HAS_SHARED_TAPES
+            for (std::size_t written = 0; written < length;)
+            {
+                const ssize_t n = pwrite(snapshot->m_file, cells + written, length - written,
+                                         static_cast<off_t>(offset + written));
+                if (n <= 0)
+                    throw std::bad_alloc{};
+                written += static_cast<std::size_t>(n);
+            }
+#else
+            snapshot->m_offsets.push_back(offset);
+            snapshot->m_cells.insert(snapshot->m_cells.end(), cells, cells + length);
+#endif
+        }
+
+        return snapshot;
+    }
+
+    // Back to the cells of a snapshot of a tape of the same size. Shared
+    // tapes map the pages it kept instead of copying them, and copy them
+    // only where that fails; throws std::bad_alloc when the tape itself
+    // can't be mapped again.
+    void restore(const BFTapeSnapshot &snapshot)
+    {
+#if BF_HAS_SHARED_TAPES
+        if (!map_zeroed())
+            throw std::bad_alloc{};
+        m_shared = false;
+        if (snapshot.m_pages == 0)
+            return;
+
+        const std::size_t length = snapshot.m_end - snapshot.m_first;
+        if (mmap(m_cells + snapshot.m_first, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                 snapshot.m_file, static_cast<off_t>(snapshot.m_first)) != MAP_FAILED)
+        {
+            m_shared = true;
+            return;
+        }
+
+        for (std::size_t read = 0; read < length;)
+        {
+            const ssize_t n = pread(snapshot.m_file, m_cells + snapshot.m_first + read, length - read,
+                                    static_cast<off_t>(snapshot.m_first + read));
+            if (n <= 0)
+                throw std::bad_alloc{};
+            read += static_cast<std::size_t>(n);
+        }
+#else
+        clear();
+        for (std::size_t i = 0; i < snapshot.m_offsets.size(); ++i)
+        {
+            const std::size_t offset = snapshot.m_offsets[i];
+            std::memcpy(m_cells + offset, snapshot.m_cells.data() + i * snapshot.m_page,
+                        std::min(snapshot.m_page, m_size - offset));
+        }
+#endif
+    }
+
+    // Runs body and returns whether it faulted on the guards of a tape or
+    // in fault(), where an unguarded run reports the fault and exits. The
+    // fault is recovered from with a long jump, so body must own nothing
+    // that needs destroying when it faults.
+    template <typename Body>
+    [[nodiscard]] static BFTapeFault guarded(Body &&body)
+    {
+        Recovery recovery;
+        Recovery *const previous = s_recovery;
+#if BF_HAS_GUARD_PAGES
+        const int fault = sigsetjmp(recovery, 1);
+#else
+        const int fault = setjmp(recovery);
+#endif
+        if (fault == 0)
+        {
+            s_recovery = &recovery;
+            // only the fault handler reads it, which the compiler can't see
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            body();
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+
+        s_recovery = previous;
+        return static_cast<BFTapeFault>(fault);
+    }
+
+    // a failed bounds check, handled like running into a guard region
+    [[noreturn]] static void fault(BFTapeFault where) noexcept
+    {
+#if BF_HAS_GUARD_PAGES
+        if (s_recovery)
+            siglongjmp(*s_recovery, static_cast<int>(where));
+#else
+        if (s_recovery)
+            std::longjmp(*s_recovery, static_cast<int>(where));
+#endif
+
+        std::fputs(message(where), stderr);
+        std::exit(1);
+    }
+
+private:
+#if BF_HAS_GUARD_PAGES
+    using Recovery = sigjmp_buf;
+#else
+    using Recovery = std::jmp_buf;
+#endif
+
+    static inline thread_local Recovery *s_recovery = nullptr; // the innermost guarded() of this thread
+
+    [[nodiscard]] static const char *message(BFTapeFault fault) noexcept
+    {
+        return fault == BFTapeFault::BELOW ? "Tape pointer moved below the first cell.\n"
+                                           : "Tape pointer moved past the last cell, raise --tape-size.\n";
+    }
+
+    [[nodiscard]] static std::size_t page_size() noexcept
+    {
+#if BF_HAS_GUARD_PAGES
+        return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#else
+        return SNAPSHOT_PAGE;
+#endif
+    }
+
+#if BF_HAS_SHARED_TAPES
+    // fresh zeroed pages in place of whatever the cells mapped
+    [[nodiscard]] bool map_zeroed() noexcept
+    {
+        return mmap(m_cells, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                    -1, 0) != MAP_FAILED;
+    }
+#endif
+
+#if BF_HAS_GUARD_PAGES
+    // live tapes, looked up from the fault handler without locking
+    static inline BFTapeGuardBlock s_tapes;
+    static inline struct sigaction s_previous_action{};
+
+    // every live tape has a slot, a fault on guards without one would
+    // take the whole process down; throws std::bad_alloc when no block
+    // can be added
+    void register_guards()
+    {
+        static std::once_flag installed;
+        std::call_once(installed, install_fault_handler);
+
+        const auto begin = reinterpret_cast<std::uintptr_t>(m_mapping);
+        for (BFTapeGuardBlock *block = &s_tapes;;)
+        {
+            for (BFTapeGuards &slot : block->slots)
+            {
+                std::uintptr_t expected = 0;
+                if (slot.begin.compare_exchange_strong(expected, begin))
+                {
+                    slot.cells = reinterpret_cast<std::uintptr_t>(m_cells);
+                    slot.end = begin + m_mapping_size;
+                    return;
+                }
+            }
+
+            BFTapeGuardBlock *next = block->next;
+            if (!next)
+            {
+                // the block that loses the race goes, the winner's is used
+                auto added = std::make_unique<BFTapeGuardBlock>();
+                if (block->next.compare_exchange_strong(next, added.get()))
+                    next = added.release();
+            }
+            block = next;
+        }
+    }
+
+    void unregister_guards() noexcept
+    {
+        for (BFTapeGuardBlock *block = &s_tapes; block; block = block->next)
+        {
+            for (BFTapeGuards &slot : block->slots)
+            {
+                if (slot.begin == reinterpret_cast<std::uintptr_t>(m_mapping))
+                {
+                    slot.end = 0;
+                    slot.cells = 0;
+                    slot.begin = 0;
+                    return;
+                }
+            }
+        }
+    }
+
+    static void install_fault_handler() noexcept
+    {
+        struct sigaction action{};
+        action.sa_sigaction = on_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &s_previous_action);
+    }
+
+    static void write_error(const char *message) noexcept
+    {
+        [[maybe_unused]] const auto written = write(STDERR_FILENO, message, std::strlen(message));
+    }
+
+    static void on_fault(int signal, siginfo_t *info, void *)
+    {
+        const auto address = reinterpret_cast<std::uintptr_t>(info->si_addr);
+
+        for (const BFTapeGuardBlock *block = &s_tapes; block; block = block->next)
+        {
+            for (const BFTapeGuards &slot : block->slots)
+            {
+                const std::uintptr_t begin = slot.begin, cells = slot.cells, end = slot.end;
+                if (begin == 0 || address < begin || address >= end)
+                    continue;
+
+                // faults are synchronous, so this is the thread that ran into the guard
+                if (s_recovery)
+                    siglongjmp(*s_recovery,
+                               static_cast<int>(address < cells ? BFTapeFault::BELOW : BFTapeFault::ABOVE));
+
+                write_error(message(address < cells ? BFTapeFault::BELOW : BFTapeFault::ABOVE));
+                _exit(1);
+            }
+        }
+
+        // not ours, let the previous disposition handle the re-raised fault
+        sigaction(signal, &s_previous_action, nullptr);
+    }
+#endif
+};